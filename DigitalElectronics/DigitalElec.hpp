@@ -1,3 +1,4 @@
+#pragma once
 #include <iostream>
 #include <cassert>
 #include <cmath>
@@ -182,6 +183,22 @@ namespace Hugh
             }
             return returnval;
         }
+        // Same Id as currentSCMNMOSNOVANNOCOX without the working or the warnings, for loops that only want the number
+        // Anything at or below threshold, or with Vds <= 0, is OFF
+        double currentSCMNMOSValue(double Vgs, double Vtn, double Vds, double k, double lambdan, double ecnln)
+        {
+            double Vgstn = Vgs - Vtn;
+            if (Vgstn <= 0 || Vds <= 0)
+            {
+                return 0;
+            }
+            double VDSsat = (Vgstn * ecnln) / (Vgstn + ecnln);
+            if (Vds <= VDSsat)
+            {
+                return (k / (1 + (Vds / ecnln))) * ((Vgstn * Vds) - ((Vds * Vds) / 2));
+            }
+            return ((k / 2) * ecnln) * ((Vgstn * Vgstn) / (Vgstn + ecnln)) * (1 + lambdan * (Vds - VDSsat));
+        }
         // Short Channel Model using Lambdan and kprime and ecnln
         DigETuple<TransistorPhase> currentSCMNMOSNOVANNOCOX(double Vgs, double Vtn, double Vds, double kprime, double lambdan, double WL, double ecnln)
         {
@@ -275,6 +292,21 @@ namespace Hugh
             }
             return returnval;
         }
+        // Same Id as currentSCMPMOSNOVANNOCOX without the working or the warnings
+        double currentSCMPMOSValue(double Vsg, double Vtp, double Vsd, double k, double lambdap, double ecplp)
+        {
+            double Vsgtp = Vsg + Vtp;
+            if (Vsgtp <= 0 || Vsd <= 0)
+            {
+                return 0;
+            }
+            double VSDsat = (Vsgtp * ecplp) / (Vsgtp + ecplp);
+            if (Vsd <= VSDsat)
+            {
+                return (k / (1 + (Vsd / ecplp))) * ((Vsgtp * Vsd) - ((Vsd * Vsd) / 2));
+            }
+            return ((k / 2) * ecplp) * ((Vsgtp * Vsgtp) / (Vsgtp + ecplp)) * (1 + lambdap * (Vsd - VSDsat));
+        }
         DigETuple<TransistorPhase> currentSCMPMOSNOVANNOCOX(double Vsg, double Vtp, double Vsd, double kprime, double lambdap, double WL, double ecplp)
         {
             return currentSCMPMOSNOVANNOCOX(Vsg, Vtp, Vsd, WL * kprime, lambdap, ecplp);
@@ -473,7 +505,7 @@ namespace Hugh
             double ln1 = std::log(ln1Stage1 * ln1Stage2);
             double ln2 = std::log((2 * (Vgs - Vtn) - (Vd - (-Vss))) / (2 * (Vgs - Vtn) - (Vc - (-Vss))));
             double total = inverted * ln1;
-            if (!std::isinf(Ecnln))
+            if (!std::isinf(EcnLn))
             {
                 total *= (2 / EcnLn) * ln2;
             }
@@ -0,0 +1,279 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <string>
+#include <vector>
+#include "DigitalElec.hpp"
+#include "scheduler.hpp"
+namespace Hugh
+{
+    namespace DigitalElectronics
+    {
+        // kT/q at 300K
+        constexpr double ThermalVoltage = 0.025852;
+        // Device parameters of the cell driving a net, same naming as currentSCMNMOSNOVANNOCOX
+        // Vtp is negative, like everywhere else
+        // Kn = kprime * W / L, Kp = kprime * W / L
+        // I0n / I0p is the subthreshold current when Vgs is right at Vt
+        struct PowerCellParams
+        {
+            double Vtn;
+            double Vtp;
+            double Kn;
+            double Kp;
+            double lambdan;
+            double lambdap;
+            double EcnLn;
+            double EcpLp;
+            double I0n;
+            double I0p;
+            double slopeFactor = 1.5;
+        };
+        // What is left of a cell after characterizing it once, so the per net loop is only multiplies
+        // scIntegral = integral of Isc over Vin across the overlap window (A * V)
+        // Energy per transition = slew * scIntegral, since dVin / dt = Vdd / slew and E = Vdd * integral(Isc dt)
+        struct PowerCellModel
+        {
+            double scIntegral = 0;
+            double leakN = 0;
+            double leakP = 0;
+        };
+        // Subthreshold current of an OFF device with Vgs = 0
+        // Isub = I0 * exp((Vgs - Vt) / (n * VT)) * (1 - exp(-Vds / VT))
+        double subthresholdLeakage(double I0, double Vt, double Vds, double slopeFactor)
+        {
+            return I0 * std::exp(-std::fabs(Vt) / (slopeFactor * ThermalVoltage)) * (1 - std::exp(-Vds / ThermalVoltage));
+        }
+        // Both devices conduct while Vtn < Vin < Vdd + Vtp, the current through the stack is whichever device
+        // gives less. Vds of both is taken as Vdd / 2, the output is mid swing during the overlap
+        PowerCellModel characterizePowerCell(const PowerCellParams &cell, double Vdd, int steps = 64)
+        {
+            PowerCellModel returnval;
+            returnval.leakN = subthresholdLeakage(cell.I0n, cell.Vtn, Vdd, cell.slopeFactor);
+            returnval.leakP = subthresholdLeakage(cell.I0p, cell.Vtp, Vdd, cell.slopeFactor);
+            double low = cell.Vtn;
+            double high = Vdd + cell.Vtp;
+            if (high <= low || steps <= 0)
+            {
+                return returnval;
+            }
+            // Midpoint rule, the end points have Vgs == Vt which the current models complain about
+            double dV = (high - low) / steps;
+            double total = 0;
+            for (int i = 0; i < steps; i++)
+            {
+                double Vin = low + (i + 0.5) * dV;
+                double In = currentSCMNMOSNOVANNOCOX(Vin, cell.Vtn, Vdd / 2, cell.Kn, cell.lambdan, cell.EcnLn).value;
+                double Ip = currentSCMPMOSNOVANNOCOX(Vdd - Vin, cell.Vtp, Vdd / 2, cell.Kp, cell.lambdap, cell.EcpLp).value;
+                total += std::min(In, Ip);
+            }
+            returnval.scIntegral = total * dV;
+            return returnval;
+        }
+        // One entry per net, kept as separate arrays so the power loop runs straight down memory
+        // toggles = transitions per clock cycle, probability = chance the driver input is high
+        // cell indexes the PowerCellModel of whatever drives the net
+        struct PowerNets
+        {
+            std::vector<double> toggles;
+            std::vector<double> probability;
+            std::vector<double> capacitance;
+            std::vector<double> slew;
+            std::vector<unsigned> cell;
+            std::size_t size() const
+            {
+                return capacitance.size();
+            }
+            void resize(std::size_t n)
+            {
+                toggles.resize(n);
+                probability.resize(n);
+                capacitance.resize(n);
+                slew.resize(n);
+                cell.resize(n);
+            }
+        };
+        // Nets [begin, end) belong to the block, keep nets of a block next to each other
+        struct PowerBlock
+        {
+            std::string name;
+            std::size_t begin;
+            std::size_t end;
+        };
+        struct PowerBreakdown
+        {
+            double dynamic = 0;
+            double shortCircuit = 0;
+            double leakage = 0;
+            double total() const
+            {
+                return dynamic + shortCircuit + leakage;
+            }
+        };
+        // names[i] is the PowerBlock name of blocks[i]
+        struct PowerReport
+        {
+            std::vector<PowerBreakdown> blocks;
+            std::vector<std::string> names;
+            PowerBreakdown total;
+            friend std::ostream &operator<<(std::ostream &os, const PowerReport &report)
+            {
+                for (std::size_t i = 0; i < report.blocks.size(); i++)
+                {
+                    const PowerBreakdown &b = report.blocks[i];
+                    os << "Block ";
+                    if (i < report.names.size() && !report.names[i].empty())
+                    {
+                        os << report.names[i];
+                    }
+                    else
+                    {
+                        os << i;
+                    }
+                    os << " Dynamic: " << b.dynamic << " Short circuit: " << b.shortCircuit
+                       << " Leakage: " << b.leakage << " Total: " << b.total() << std::endl;
+                }
+                os << "Total Dynamic: " << report.total.dynamic << " Short circuit: " << report.total.shortCircuit
+                   << " Leakage: " << report.total.leakage << " Total: " << report.total.total() << std::endl;
+                return os;
+            }
+        };
+        // Probabilistic activity, a net that is high with probability p and independent cycle to cycle
+        // toggles 2 * p * (1 - p) times per cycle
+        void activityFromProbability(PowerNets &nets)
+        {
+            for (std::size_t i = 0; i < nets.size(); i++)
+            {
+                double p = nets.probability[i];
+                nets.toggles[i] = 2 * p * (1 - p);
+            }
+        }
+        // Vector file, one line per clock cycle with one '0' / '1' per net, spaces and tabs between them are fine
+        // Any line with something else on it, like a '#' comment or a header, isn't a cycle and is skipped whole
+        // Returns the number of cycles read, a file with less than two cycles leaves toggles at 0
+        std::size_t activityFromVectors(std::istream &in, PowerNets &nets)
+        {
+            std::vector<char> previous(nets.size(), 0);
+            std::vector<std::size_t> toggleCount(nets.size(), 0);
+            std::vector<std::size_t> highCount(nets.size(), 0);
+            std::size_t cycles = 0;
+            std::string line;
+            while (std::getline(in, line))
+            {
+                if (line.find_first_not_of("01 \t\r") != std::string::npos)
+                {
+                    continue;
+                }
+                std::size_t net = 0;
+                for (char c : line)
+                {
+                    if (c == ' ' || c == '\t' || c == '\r' || net >= nets.size())
+                    {
+                        continue;
+                    }
+                    char value = c - '0';
+                    if (cycles > 0 && value != previous[net])
+                    {
+                        toggleCount[net]++;
+                    }
+                    highCount[net] += value;
+                    previous[net] = value;
+                    net++;
+                }
+                if (net > 0)
+                {
+                    cycles++;
+                }
+            }
+            for (std::size_t i = 0; i < nets.size() && cycles > 0; i++)
+            {
+                nets.probability[i] = static_cast<double>(highCount[i]) / cycles;
+                nets.toggles[i] = cycles > 1 ? static_cast<double>(toggleCount[i]) / (cycles - 1) : 0;
+            }
+            return cycles;
+        }
+        // The inner loop over a block
+        // Dynamic: 1/2 * toggles * C * Vdd^2 * f, a charge and discharge is two toggles
+        // Short circuit: toggles * f * slew * scIntegral
+        // Leakage: input high leaves the PMOS off, input low leaves the NMOS off
+        // The cell models are split into one flat array per field first, so each lane gathers plain doubles
+        // instead of picking fields out of a struct. The sums are split over PowerLanes partial sums,
+        // floating point adds don't reassociate on their own so one running sum would keep the loop scalar
+        constexpr std::size_t PowerLanes = 4;
+        PowerBreakdown blockPower(const PowerNets &nets, const std::vector<PowerCellModel> &cells, std::size_t begin,
+                                  std::size_t end, double Vdd, double frequency)
+        {
+            PowerBreakdown returnval;
+            std::vector<double> scIntegralOf(cells.size());
+            std::vector<double> leakNOf(cells.size());
+            std::vector<double> leakPOf(cells.size());
+            for (std::size_t c = 0; c < cells.size(); c++)
+            {
+                scIntegralOf[c] = cells[c].scIntegral;
+                leakNOf[c] = cells[c].leakN;
+                leakPOf[c] = cells[c].leakP;
+            }
+            const double *toggles = nets.toggles.data();
+            const double *probability = nets.probability.data();
+            const double *capacitance = nets.capacitance.data();
+            const double *slew = nets.slew.data();
+            const unsigned *cell = nets.cell.data();
+            const double *scIntegral = scIntegralOf.data();
+            const double *leakN = leakNOf.data();
+            const double *leakP = leakPOf.data();
+            double dynamic[PowerLanes] = {};
+            double shortCircuit[PowerLanes] = {};
+            double leakage[PowerLanes] = {};
+            std::size_t i = begin;
+            for (; i + PowerLanes <= end; i += PowerLanes)
+            {
+                for (std::size_t l = 0; l < PowerLanes; l++)
+                {
+                    unsigned c = cell[i + l];
+                    dynamic[l] += toggles[i + l] * capacitance[i + l];
+                    shortCircuit[l] += toggles[i + l] * slew[i + l] * scIntegral[c];
+                    leakage[l] += probability[i + l] * leakP[c] + (1 - probability[i + l]) * leakN[c];
+                }
+            }
+            for (std::size_t l = 0; i < end; i++, l++)
+            {
+                unsigned c = cell[i];
+                dynamic[l] += toggles[i] * capacitance[i];
+                shortCircuit[l] += toggles[i] * slew[i] * scIntegral[c];
+                leakage[l] += probability[i] * leakP[c] + (1 - probability[i]) * leakN[c];
+            }
+            for (std::size_t l = 1; l < PowerLanes; l++)
+            {
+                dynamic[0] += dynamic[l];
+                shortCircuit[0] += shortCircuit[l];
+                leakage[0] += leakage[l];
+            }
+            returnval.dynamic = 0.5 * dynamic[0] * Vdd * Vdd * frequency;
+            returnval.shortCircuit = shortCircuit[0] * frequency;
+            returnval.leakage = leakage[0] * Vdd;
+            return returnval;
+        }
+        // One pool task per block
+        PowerReport estimatePower(const PowerNets &nets, const std::vector<PowerCellModel> &cells,
+                                  const std::vector<PowerBlock> &blocks, double Vdd, double frequency,
+                                  Util::ThreadPool &pool = Util::sharedPool())
+        {
+            PowerReport returnval;
+            for (const PowerBlock &block : blocks)
+            {
+                returnval.names.push_back(block.name);
+            }
+            returnval.blocks = pool.wait(pool.map(blocks.size(), [&](std::size_t b)
+                                                  { return blockPower(nets, cells, blocks[b].begin, blocks[b].end, Vdd, frequency); },
+                                                  Util::TaskPriority::NORMAL, Util::CancellationToken(), 1));
+            for (const PowerBreakdown &b : returnval.blocks)
+            {
+                returnval.total.dynamic += b.dynamic;
+                returnval.total.shortCircuit += b.shortCircuit;
+                returnval.total.leakage += b.leakage;
+            }
+            return returnval;
+        }
+    }
+}
@@ -0,0 +1,322 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "DigitalElec.hpp"
+#include "scheduler.hpp"
+namespace Hugh
+{
+    namespace DigitalElectronics
+    {
+        // Everything a stage needs that doesn't change with W/L
+        // knprime / kpprime = Un * Cox / Up * Cox, Vtp is negative
+        // CgPerWL / CdPerWL = gate / drain capacitance of a device with W/L = 1
+        struct SizingProcess
+        {
+            double Vdd;
+            double Vtn;
+            double Vtp;
+            double knprime;
+            double kpprime;
+            double lambdan;
+            double lambdap;
+            double EcnLn;
+            double EcpLp;
+            double CgPerWL;
+            double CdPerWL;
+        };
+        enum class SizingObjective
+        {
+            DELAY,
+            ENERGYDELAY
+        };
+        // stages = 0 picks the stage count between 1 and maxStages with the polarity inverting asks for
+        // fanout[i] = how many stage i + 1 gates every stage i gate drives, so it has stages - 1 entries,
+        // leave it empty for a plain buffer chain. Giving a fanout without stages takes stages from its size
+        // Cload is the load on every last stage gate, a tree with N leaves drives N * Cload in total
+        // maxInputCap bounds the input capacitance of the first stage (infinity = no limit), maxArea bounds the
+        // summed W/L of every device (0 = no limit). Without an input limit the first stage grows until the area limit
+        // stops it, so leaving both unlimited, or a minSize first stage already over maxInputCap, comes back infeasible
+        // Kr is the Kn / Kp wanted, it gets pulled back inside [VthMin, VthMax] if it misses the window
+        struct SizingProblem
+        {
+            double Cload;
+            double maxInputCap = std::numeric_limits<double>::infinity();
+            double maxArea = 0;
+            double Kr = 1;
+            double VthMin = 0;
+            double VthMax = std::numeric_limits<double>::infinity();
+            double minSize = 1;
+            int stages = 0;
+            int maxStages = 12;
+            bool inverting = false;
+            SizingObjective objective = SizingObjective::DELAY;
+            std::vector<double> fanout;
+        };
+        struct SizingResult
+        {
+            // NMOS W/L of each stage, the PMOS is pmosRatio times that
+            std::vector<double> sizes;
+            std::vector<double> stageDelay;
+            double pmosRatio = 1;
+            double Kr = 1;
+            double Vth = 0;
+            double delay = 0;
+            double energy = 0;
+            double area = 0;
+            bool feasible = false;
+        };
+        // Vth falls as Kr grows, so the window turns into a [KrLow, KrHigh] range found by bisection on CMOSInverterVthCalc
+        double sizingKrForVth(const SizingProcess &process, double Vth)
+        {
+            double low = 1e-6;
+            double high = 1e6;
+            for (int i = 0; i < 100; i++)
+            {
+                double mid = std::sqrt(low * high);
+                if (CMOSInverterVthCalc(process.Vtn, mid, process.Vdd, process.Vtp).value > Vth)
+                {
+                    low = mid;
+                }
+                else
+                {
+                    high = mid;
+                }
+            }
+            return std::sqrt(low * high);
+        }
+        double sizingClampKr(const SizingProcess &process, const SizingProblem &problem)
+        {
+            double Kr = problem.Kr;
+            if (CMOSInverterVthCalc(process.Vtn, Kr, process.Vdd, process.Vtp).value > problem.VthMax)
+            {
+                Kr = sizingKrForVth(process, problem.VthMax);
+            }
+            if (CMOSInverterVthCalc(process.Vtn, Kr, process.Vdd, process.Vtp).value < problem.VthMin)
+            {
+                Kr = sizingKrForVth(process, problem.VthMin);
+            }
+            return Kr;
+        }
+        // The sized chain in the form the optimizer works with
+        // Stage i delay = R / s[i] * (fanout[i] * g * s[i + 1] + p * s[i]), every last stage gate drives Cload
+        // copies[i] = how many stage i gates there are, so the energy counts Cload once per leaf
+        // R comes from the saturation current of a W/L = 1 device, averaged over the rising and falling edge
+        // the same way CMOSInverterDeltaTDownSat does it: t = C * (Vdd / 2) / Id
+        struct SizingChain
+        {
+            double R;
+            double g;
+            double p;
+            double energyPerWL;
+            double Vdd;
+            double Cload;
+            std::vector<double> fanout;
+            std::vector<double> copies;
+            double load(const std::vector<double> &s, std::size_t i) const
+            {
+                return i + 1 < s.size() ? fanout[i] * g * s[i + 1] : Cload;
+            }
+            double delay(const std::vector<double> &s) const
+            {
+                double total = 0;
+                for (std::size_t i = 0; i < s.size(); i++)
+                {
+                    total += R * (load(s, i) / s[i] + p);
+                }
+                return total;
+            }
+            double energy(const std::vector<double> &s) const
+            {
+                double total = copies.back() * Cload;
+                for (std::size_t i = 0; i < s.size(); i++)
+                {
+                    total += copies[i] * (g + p) * s[i];
+                }
+                return total * Vdd * Vdd;
+            }
+        };
+        SizingChain sizingChain(const SizingProcess &process, const SizingProblem &problem, int stages, double pmosRatio)
+        {
+            SizingChain returnval;
+            double Idn = currentSCMNMOSNOVANNOCOX(process.Vdd, process.Vtn, process.Vdd, process.knprime, process.lambdan, process.EcnLn).value;
+            double Idp = currentSCMPMOSNOVANNOCOX(process.Vdd, process.Vtp, process.Vdd, process.kpprime * pmosRatio, process.lambdap, process.EcpLp).value;
+            returnval.R = (process.Vdd / 4) * (1 / Idn + 1 / Idp);
+            returnval.g = process.CgPerWL * (1 + pmosRatio);
+            returnval.p = process.CdPerWL * (1 + pmosRatio);
+            returnval.Vdd = process.Vdd;
+            returnval.Cload = problem.Cload;
+            returnval.fanout = problem.fanout.empty() ? std::vector<double>(stages - 1, 1) : problem.fanout;
+            returnval.copies.assign(stages, 1);
+            for (int i = 1; i < stages; i++)
+            {
+                returnval.copies[i] = returnval.copies[i - 1] * returnval.fanout[i - 1];
+            }
+            return returnval;
+        }
+        // Minimizes delay + sum(cost[i] * s[i]) one stage at a time, setting dD/ds[i] + cost[i] = 0 gives s[i] in closed form:
+        // s[i] = sqrt(R * load[i] / (R * fanout[i - 1] * g / s[i - 1] + cost[i]))
+        // The objective is convex in log(s) so the sweeps settle on the global minimum for that cost
+        void sizingSweep(const SizingChain &chain, std::vector<double> &s, const std::vector<double> &cost, double maxFirst,
+                         double minSize)
+        {
+            for (int sweep = 0; sweep < 500; sweep++)
+            {
+                double change = 0;
+                for (std::size_t i = 0; i < s.size(); i++)
+                {
+                    double back = i == 0 ? 0 : chain.R * chain.fanout[i - 1] * chain.g / s[i - 1];
+                    double bottom = back + cost[i];
+                    double next = bottom > 0 ? std::sqrt(chain.R * chain.load(s, i) / bottom) : maxFirst;
+                    next = std::max(next, minSize);
+                    if (i == 0)
+                    {
+                        next = std::min(next, maxFirst);
+                    }
+                    change = std::max(change, std::fabs(next - s[i]) / s[i]);
+                    s[i] = next;
+                }
+                if (change < 1e-10)
+                {
+                    return;
+                }
+            }
+        }
+        double sizingArea(const std::vector<double> &s, const SizingChain &chain, double pmosRatio)
+        {
+            double total = 0;
+            for (std::size_t i = 0; i < s.size(); i++)
+            {
+                total += chain.copies[i] * s[i] * (1 + pmosRatio);
+            }
+            return total;
+        }
+        // areaWeight is the Lagrange multiplier on the area limit, for ENERGYDELAY the energy weight is D / E,
+        // which is where d(E * D) = E * dD + D * dE is stationary, so it gets refreshed until it stops moving
+        void sizingSolve(const SizingChain &chain, const SizingProblem &problem, double pmosRatio, double areaWeight,
+                         double maxFirst, std::vector<double> &s)
+        {
+            std::vector<double> cost(s.size());
+            double energyWeight = 0;
+            for (int outer = 0; outer < 50; outer++)
+            {
+                for (std::size_t i = 0; i < s.size(); i++)
+                {
+                    cost[i] = chain.copies[i] * (areaWeight * (1 + pmosRatio) + energyWeight * chain.Vdd * chain.Vdd * (chain.g + chain.p));
+                }
+                sizingSweep(chain, s, cost, maxFirst, problem.minSize);
+                if (problem.objective != SizingObjective::ENERGYDELAY)
+                {
+                    return;
+                }
+                double next = chain.delay(s) / chain.energy(s);
+                if (std::fabs(next - energyWeight) <= 1e-9 * next)
+                {
+                    return;
+                }
+                energyWeight = next;
+            }
+        }
+        SizingResult sizeChain(const SizingProcess &process, const SizingProblem &problem, int stages)
+        {
+            SizingResult returnval;
+            if (stages < 1 || (!problem.fanout.empty() && problem.fanout.size() + 1 != static_cast<std::size_t>(stages)))
+            {
+                return returnval;
+            }
+            returnval.Kr = sizingClampKr(process, problem);
+            returnval.pmosRatio = process.knprime / (process.kpprime * returnval.Kr);
+            returnval.Vth = CMOSInverterVthCalc(process.Vtn, returnval.Kr, process.Vdd, process.Vtp).value;
+            SizingChain chain = sizingChain(process, problem, stages, returnval.pmosRatio);
+            bool unbounded = !std::isfinite(problem.maxInputCap);
+            if (problem.minSize * chain.g > problem.maxInputCap * (1 + 1e-12) || (unbounded && problem.maxArea <= 0))
+            {
+                return returnval;
+            }
+            double maxFirst = std::max(problem.minSize, problem.maxInputCap / chain.g);
+            std::vector<double> s(stages, unbounded ? problem.minSize : maxFirst);
+            if (!unbounded)
+            {
+                sizingSolve(chain, problem, returnval.pmosRatio, 0, maxFirst, s);
+            }
+            returnval.feasible = true;
+            if (unbounded || (problem.maxArea > 0 && sizingArea(s, chain, returnval.pmosRatio) > problem.maxArea))
+            {
+                // Bisect the multiplier in log space, area only shrinks as it grows
+                double low = 0;
+                double high = chain.R * chain.Cload / (problem.minSize * problem.minSize);
+                std::vector<double> trial = s;
+                sizingSolve(chain, problem, returnval.pmosRatio, high, maxFirst, trial);
+                returnval.feasible = sizingArea(trial, chain, returnval.pmosRatio) <= problem.maxArea;
+                for (int i = 0; i < 100 && returnval.feasible; i++)
+                {
+                    double mid = low == 0 ? high * 1e-12 : std::sqrt(low * high);
+                    std::vector<double> guess = trial;
+                    sizingSolve(chain, problem, returnval.pmosRatio, mid, maxFirst, guess);
+                    if (sizingArea(guess, chain, returnval.pmosRatio) > problem.maxArea)
+                    {
+                        low = mid;
+                    }
+                    else
+                    {
+                        high = mid;
+                        trial = guess;
+                    }
+                    if (low > 0 && high / low < 1 + 1e-9)
+                    {
+                        break;
+                    }
+                }
+                s = trial;
+            }
+            returnval.sizes = s;
+            for (std::size_t i = 0; i < s.size(); i++)
+            {
+                returnval.stageDelay.push_back(chain.R * (chain.load(s, i) / s[i] + chain.p));
+            }
+            returnval.delay = chain.delay(s);
+            returnval.energy = chain.energy(s);
+            returnval.area = sizingArea(s, chain, returnval.pmosRatio);
+            return returnval;
+        }
+        double sizingScore(const SizingResult &result, SizingObjective objective)
+        {
+            if (!result.feasible)
+            {
+                return std::numeric_limits<double>::infinity();
+            }
+            return objective == SizingObjective::DELAY ? result.delay : result.delay * result.energy;
+        }
+        // A fixed stage count or a fan-out tree is sized as given, a mismatched fanout comes back infeasible
+        // Otherwise every stage count with the right polarity is tried
+        SizingResult sizeChain(const SizingProcess &process, const SizingProblem &problem)
+        {
+            if (problem.stages > 0 || !problem.fanout.empty())
+            {
+                return sizeChain(process, problem, problem.stages > 0 ? problem.stages : static_cast<int>(problem.fanout.size()) + 1);
+            }
+            SizingResult best;
+            double bestScore = std::numeric_limits<double>::infinity();
+            for (int stages = problem.inverting ? 1 : 2; stages <= problem.maxStages; stages += 2)
+            {
+                SizingResult candidate = sizeChain(process, problem, stages);
+                double score = sizingScore(candidate, problem.objective);
+                if (score < bestScore || best.sizes.empty())
+                {
+                    bestScore = score;
+                    best = candidate;
+                }
+            }
+            return best;
+        }
+        // Many chains at once, one pool task per chain
+        std::vector<SizingResult> sizeChains(const SizingProcess &process, const std::vector<SizingProblem> &problems,
+                                             Util::ThreadPool &pool = Util::sharedPool())
+        {
+            return pool.wait(pool.map(problems.size(), [&](std::size_t i)
+                                      { return sizeChain(process, problems[i]); },
+                                      Util::TaskPriority::NORMAL, Util::CancellationToken(), 1));
+        }
+    }
+}
@@ -0,0 +1,372 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "DigitalElec.hpp"
+#include "resultcache.hpp"
+#include "scheduler.hpp"
+namespace Hugh
+{
+    namespace DigitalElectronics
+    {
+        // An inverter cell built from one NMOS and one PMOS, everything in SI units
+        // Vtp is negative, Cin is the input pin capacitance and Cpar the cell's own output capacitance
+        struct LibertyCell
+        {
+            std::string name;
+            double Vdd;
+            double Vtn;
+            double Vtp;
+            double knprime;
+            double kpprime;
+            double WLn;
+            double WLp;
+            double lambdan;
+            double lambdap;
+            double EcnLn;
+            double EcpLp;
+            double Cin;
+            double Cpar;
+        };
+        // NLDM table, rows are input slew and columns are output load, values row major
+        struct LibertyTable
+        {
+            std::vector<double> slews;
+            std::vector<double> loads;
+            std::vector<double> values;
+            double at(std::size_t slew, std::size_t load) const
+            {
+                return values[slew * loads.size() + load];
+            }
+        };
+        struct LibertyTiming
+        {
+            LibertyTable cellRise;
+            LibertyTable cellFall;
+            LibertyTable riseTransition;
+            LibertyTable fallTransition;
+            LibertyTable risePower;
+            LibertyTable fallPower;
+        };
+        // One table point: 50% to 50% delay, 20% to 80% output transition, internal energy
+        // Internal energy leaves out what goes into charging the load, the way Liberty internal_power wants it
+        struct LibertyPoint
+        {
+            double delay = 0;
+            double transition = 0;
+            double energy = 0;
+        };
+        // Transient of one edge, input is a linear ramp whose 20% to 80% time is slew
+        // C dVout/dt = Ip - In with both currents off the short channel model, stepped with Heun's method
+        // Once the input has finished only one device is on, so whatever supply energy is left is C * Vdd * (Vdd - Vout)
+        // Throws std::runtime_error if the output never gets through 20%, 50% and 80%, e.g. Vdd below threshold
+        LibertyPoint simulateInverterEdge(const LibertyCell &cell, double slew, double load, bool outputRising)
+        {
+            LibertyPoint returnval;
+            double Vdd = cell.Vdd;
+            double C = load + cell.Cpar;
+            double kn = cell.knprime * cell.WLn;
+            double kp = cell.kpprime * cell.WLp;
+            double ramp = std::max(slew / 0.6, 1e-18);
+            auto input = [&](double t)
+            {
+                double fraction = std::min(1.0, t / ramp);
+                return outputRising ? Vdd * (1 - fraction) : Vdd * fraction;
+            };
+            auto pullUp = [&](double Vin, double Vout)
+            {
+                return currentSCMPMOSValue(Vdd - Vin, cell.Vtp, Vdd - Vout, kp, cell.lambdap, cell.EcpLp);
+            };
+            auto slope = [&](double Vin, double Vout)
+            {
+                return (pullUp(Vin, Vout) - currentSCMNMOSValue(Vin, cell.Vtn, Vout, kn, cell.lambdan, cell.EcnLn)) / C;
+            };
+            double drive = outputRising ? currentSCMPMOSValue(Vdd, cell.Vtp, Vdd, kp, cell.lambdap, cell.EcpLp)
+                                        : currentSCMNMOSValue(Vdd, cell.Vtn, Vdd, kn, cell.lambdan, cell.EcnLn);
+            double tau = C * Vdd / drive;
+            double dt = std::min(ramp, tau) / 400;
+            double start = outputRising ? 0 : Vdd;
+            double Vout = start;
+            double t = 0;
+            double charge = 0;
+            double crossed[3] = {-1, -1, -1};
+            const double levels[3] = {0.2, 0.5, 0.8};
+            for (int step = 0; step < 10000000; step++)
+            {
+                double Vin = input(t);
+                double Vin2 = input(t + dt);
+                double k1 = slope(Vin, Vout);
+                double k2 = slope(Vin2, Vout + dt * k1);
+                double next = Vout + dt * (k1 + k2) / 2;
+                charge += dt * (pullUp(Vin, Vout) + pullUp(Vin2, next)) / 2;
+                for (int l = 0; l < 3; l++)
+                {
+                    double level = (outputRising ? levels[l] : 1 - levels[l]) * Vdd;
+                    if (crossed[l] < 0 && (next - level) * (Vout - level) <= 0 && next != Vout)
+                    {
+                        crossed[l] = t + dt * (level - Vout) / (next - Vout);
+                    }
+                }
+                bool stalled = next == Vout;
+                Vout = next;
+                t += dt;
+                if (t >= ramp && (crossed[2] >= 0 || stalled))
+                {
+                    break;
+                }
+            }
+            for (int l = 0; l < 3; l++)
+            {
+                if (crossed[l] < 0)
+                {
+                    std::ostringstream message;
+                    message << cell.name << ": " << (outputRising ? "rising" : "falling") << " output never crossed "
+                            << (outputRising ? levels[l] : 1 - levels[l]) * 100 << "% of Vdd at slew " << slew << " load " << load;
+                    throw std::runtime_error(message.str());
+                }
+            }
+            if (outputRising)
+            {
+                charge += C * (Vdd - Vout);
+            }
+            returnval.delay = crossed[1] - ramp / 2;
+            returnval.transition = crossed[2] - crossed[0];
+            returnval.energy = Vdd * charge - (outputRising ? load * Vdd * Vdd : 0);
+            return returnval;
+        }
+        // Every slew / load pair of every table goes out as one pool task, a failed edge throws out of here
+        // Safe to call from a task on the same pool, the wait runs queued edges instead of holding the worker
+        LibertyTiming characterizeCell(const LibertyCell &cell, const std::vector<double> &slews, const std::vector<double> &loads,
+                                       Util::ThreadPool &pool = Util::sharedPool())
+        {
+            LibertyTiming returnval;
+            std::size_t points = slews.size() * loads.size();
+            auto edges = pool.wait(pool.map(2 * points, [&](std::size_t i)
+                                            { return simulateInverterEdge(cell, slews[(i % points) / loads.size()], loads[i % loads.size()], i < points); },
+                                            Util::TaskPriority::NORMAL, Util::CancellationToken(), 1));
+            LibertyTable *tables[6] = {&returnval.cellRise, &returnval.cellFall, &returnval.riseTransition,
+                                       &returnval.fallTransition, &returnval.risePower, &returnval.fallPower};
+            for (LibertyTable *table : tables)
+            {
+                table->slews = slews;
+                table->loads = loads;
+                table->values.resize(points);
+            }
+            for (std::size_t i = 0; i < points; i++)
+            {
+                returnval.cellRise.values[i] = edges[i].delay;
+                returnval.riseTransition.values[i] = edges[i].transition;
+                returnval.risePower.values[i] = edges[i].energy;
+                returnval.cellFall.values[i] = edges[points + i].delay;
+                returnval.fallTransition.values[i] = edges[points + i].transition;
+                returnval.fallPower.values[i] = edges[points + i].energy;
+            }
+            return returnval;
+        }
+        // Finished tables, keyed by the exact bits of every parameter and axis point
+        struct LibertyCache
+        {
+            std::mutex lock;
+            std::unordered_map<std::string, std::shared_ptr<const LibertyTiming>> tables;
+        };
+        // Every parameter that changes the tables, then both axes with their lengths in front
+        std::vector<double> libertyParams(const LibertyCell &cell, const std::vector<double> &slews, const std::vector<double> &loads)
+        {
+            std::vector<double> returnval = {cell.Vdd, cell.Vtn, cell.Vtp, cell.knprime, cell.kpprime, cell.WLn, cell.WLp,
+                                             cell.lambdan, cell.lambdap, cell.EcnLn, cell.EcpLp, cell.Cpar};
+            returnval.push_back(static_cast<double>(slews.size()));
+            returnval.insert(returnval.end(), slews.begin(), slews.end());
+            returnval.push_back(static_cast<double>(loads.size()));
+            returnval.insert(returnval.end(), loads.begin(), loads.end());
+            return returnval;
+        }
+        std::string libertyKey(const LibertyCell &cell, const std::vector<double> &slews, const std::vector<double> &loads)
+        {
+            std::ostringstream key;
+            key << std::hexfloat;
+            for (double param : libertyParams(cell, slews, loads))
+            {
+                key << param << ',';
+            }
+            return key.str();
+        }
+        std::shared_ptr<const LibertyTiming> characterizeCell(const LibertyCell &cell, const std::vector<double> &slews,
+                                                              const std::vector<double> &loads, LibertyCache &cache,
+                                                              Util::ThreadPool &pool = Util::sharedPool())
+        {
+            std::string key = libertyKey(cell, slews, loads);
+            {
+                std::lock_guard<std::mutex> guard(cache.lock);
+                auto found = cache.tables.find(key);
+                if (found != cache.tables.end())
+                {
+                    return found->second;
+                }
+            }
+            auto returnval = std::make_shared<const LibertyTiming>(characterizeCell(cell, slews, loads, pool));
+            std::lock_guard<std::mutex> guard(cache.lock);
+            return cache.tables.emplace(key, returnval).first->second;
+        }
+        // The six tables back to back in LibertyTiming order, the way the disk cache stores them
+        std::vector<double> libertyPayload(const LibertyTiming &timing)
+        {
+            std::vector<double> returnval;
+            for (const LibertyTable *table : {&timing.cellRise, &timing.cellFall, &timing.riseTransition,
+                                              &timing.fallTransition, &timing.risePower, &timing.fallPower})
+            {
+                returnval.insert(returnval.end(), table->values.begin(), table->values.end());
+            }
+            return returnval;
+        }
+        // Same as above, with the on disk cache behind the in memory one so a fresh process skips the sweep too
+        // A disk entry that isn't exactly six full tables long gets recomputed and overwritten, never loaded
+        std::shared_ptr<const LibertyTiming> characterizeCell(const LibertyCell &cell, const std::vector<double> &slews,
+                                                              const std::vector<double> &loads, LibertyCache &cache,
+                                                              Util::ResultCache &disk, Util::ThreadPool &pool = Util::sharedPool())
+        {
+            std::string key = libertyKey(cell, slews, loads);
+            {
+                std::lock_guard<std::mutex> guard(cache.lock);
+                auto found = cache.tables.find(key);
+                if (found != cache.tables.end())
+                {
+                    return found->second;
+                }
+            }
+            std::size_t points = slews.size() * loads.size();
+            std::vector<double> params = libertyParams(cell, slews, loads);
+            auto timing = std::make_shared<LibertyTiming>();
+            std::optional<Util::CachedResult> stored = disk.find("liberty.inverter", params);
+            if (stored && stored->size() == 6 * points)
+            {
+                LibertyTable *tables[6] = {&timing->cellRise, &timing->cellFall, &timing->riseTransition,
+                                           &timing->fallTransition, &timing->risePower, &timing->fallPower};
+                for (int t = 0; t < 6; t++)
+                {
+                    tables[t]->slews = slews;
+                    tables[t]->loads = loads;
+                    tables[t]->values.assign(stored->begin() + t * points, stored->begin() + (t + 1) * points);
+                }
+            }
+            else
+            {
+                *timing = characterizeCell(cell, slews, loads, pool);
+                disk.store("liberty.inverter", params, libertyPayload(*timing));
+            }
+            std::shared_ptr<const LibertyTiming> returnval = timing;
+            std::lock_guard<std::mutex> guard(cache.lock);
+            return cache.tables.emplace(key, returnval).first->second;
+        }
+        // Liberty wants ns, pF and pJ (pF * V^2)
+        void writeLibertyIndex(std::ostream &os, const char *name, const std::vector<double> &axis, double scale)
+        {
+            os << name << " (\"";
+            for (std::size_t i = 0; i < axis.size(); i++)
+            {
+                os << (i ? ", " : "") << axis[i] * scale;
+            }
+            os << "\");" << std::endl;
+        }
+        void writeLibertyTable(std::ostream &os, const char *group, const std::string &templateName, const LibertyTable &table,
+                               double scale)
+        {
+            os << "                " << group << " (" << templateName << ") {" << std::endl;
+            os << "                    ";
+            writeLibertyIndex(os, "index_1", table.slews, 1e9);
+            os << "                    ";
+            writeLibertyIndex(os, "index_2", table.loads, 1e12);
+            os << "                    values ( \\" << std::endl;
+            for (std::size_t s = 0; s < table.slews.size(); s++)
+            {
+                os << "                        \"";
+                for (std::size_t l = 0; l < table.loads.size(); l++)
+                {
+                    os << (l ? ", " : "") << table.at(s, l) * scale;
+                }
+                os << "\"" << (s + 1 < table.slews.size() ? ", \\" : " \\") << std::endl;
+            }
+            os << "                    );" << std::endl;
+            os << "                }" << std::endl;
+        }
+        void writeLiberty(std::ostream &os, const std::string &library, const std::vector<LibertyCell> &cells,
+                          const std::vector<std::shared_ptr<const LibertyTiming>> &timings)
+        {
+            os << "library (" << library << ") {" << std::endl;
+            os << "    delay_model : table_lookup;" << std::endl;
+            os << "    time_unit : \"1ns\";" << std::endl;
+            os << "    voltage_unit : \"1V\";" << std::endl;
+            os << "    capacitive_load_unit (1, pf);" << std::endl;
+            if (!cells.empty())
+            {
+                os << "    nom_voltage : " << cells[0].Vdd << ";" << std::endl;
+            }
+            const char *thresholds[] = {"slew_lower_threshold_pct_rise : 20;", "slew_upper_threshold_pct_rise : 80;",
+                                        "slew_lower_threshold_pct_fall : 20;", "slew_upper_threshold_pct_fall : 80;",
+                                        "input_threshold_pct_rise : 50;", "input_threshold_pct_fall : 50;",
+                                        "output_threshold_pct_rise : 50;", "output_threshold_pct_fall : 50;"};
+            for (const char *threshold : thresholds)
+            {
+                os << "    " << threshold << std::endl;
+            }
+            for (std::size_t c = 0; c < cells.size(); c++)
+            {
+                const LibertyTable &axes = timings[c]->cellRise;
+                os << "    lu_table_template (delay_" << cells[c].name << ") {" << std::endl;
+                os << "        variable_1 : input_net_transition;" << std::endl;
+                os << "        variable_2 : total_output_net_capacitance;" << std::endl;
+                os << "        ";
+                writeLibertyIndex(os, "index_1", axes.slews, 1e9);
+                os << "        ";
+                writeLibertyIndex(os, "index_2", axes.loads, 1e12);
+                os << "    }" << std::endl;
+                os << "    power_lut_template (energy_" << cells[c].name << ") {" << std::endl;
+                os << "        variable_1 : input_transition_time;" << std::endl;
+                os << "        variable_2 : total_output_net_capacitance;" << std::endl;
+                os << "        ";
+                writeLibertyIndex(os, "index_1", axes.slews, 1e9);
+                os << "        ";
+                writeLibertyIndex(os, "index_2", axes.loads, 1e12);
+                os << "    }" << std::endl;
+            }
+            for (std::size_t c = 0; c < cells.size(); c++)
+            {
+                const LibertyCell &cell = cells[c];
+                const LibertyTiming &timing = *timings[c];
+                std::string delay = "delay_" + cell.name;
+                std::string energy = "energy_" + cell.name;
+                os << "    cell (" << cell.name << ") {" << std::endl;
+                os << "        pin (A) {" << std::endl;
+                os << "            direction : input;" << std::endl;
+                os << "            capacitance : " << cell.Cin * 1e12 << ";" << std::endl;
+                os << "        }" << std::endl;
+                os << "        pin (Y) {" << std::endl;
+                os << "            direction : output;" << std::endl;
+                os << "            function : \"!A\";" << std::endl;
+                os << "            timing () {" << std::endl;
+                os << "                related_pin : \"A\";" << std::endl;
+                os << "                timing_sense : negative_unate;" << std::endl;
+                writeLibertyTable(os, "cell_rise", delay, timing.cellRise, 1e9);
+                writeLibertyTable(os, "rise_transition", delay, timing.riseTransition, 1e9);
+                writeLibertyTable(os, "cell_fall", delay, timing.cellFall, 1e9);
+                writeLibertyTable(os, "fall_transition", delay, timing.fallTransition, 1e9);
+                os << "            }" << std::endl;
+                os << "            internal_power () {" << std::endl;
+                os << "                related_pin : \"A\";" << std::endl;
+                writeLibertyTable(os, "rise_power", energy, timing.risePower, 1e12);
+                writeLibertyTable(os, "fall_power", energy, timing.fallPower, 1e12);
+                os << "            }" << std::endl;
+                os << "        }" << std::endl;
+                os << "    }" << std::endl;
+            }
+            os << "}" << std::endl;
+        }
+    }
+}
@@ -1,3 +1,4 @@
+#pragma once
 #include <complex>
 #include <ostream>
 namespace Hugh
@@ -113,20 +114,29 @@ namespace Hugh
             return half_power_starter_parallel(resistance, inductance, capacitence) +
                    half_power_consistent(resistance, inductance, capacitence);
         }
+        enum class AngleUnit
+        {
+            RADIANS,
+            DEGREES
+        };
         // This is the polar form from an std::complex, stored in polar for easy conversion
+        // theta comes from atan2 so it keeps its quadrant, unit only changes how it prints
         struct polar_form
         {
             double r;
             double theta;
-            polar_form(std::complex<double> from)
+            AngleUnit unit = AngleUnit::DEGREES;
+            polar_form(std::complex<double> from, AngleUnit unit = AngleUnit::DEGREES)
             {
                 r = std::sqrt(from.imag() * from.imag() + from.real() * from.real());
-                theta = std::atan(from.imag() / from.real());
+                theta = std::atan2(from.imag(), from.real());
+                this->unit = unit;
             }
-            polar_form(double r, double theta)
+            polar_form(double r, double theta, AngleUnit unit = AngleUnit::DEGREES)
             {
                 this->r = r;
                 this->theta = theta;
+                this->unit = unit;
             }
             std::complex<double> to_rect()
             {
@@ -134,6 +144,11 @@ namespace Hugh
             }
             friend std::ostream &operator<<(std::ostream &os, const polar_form &polar)
             {
+                if (polar.unit == AngleUnit::RADIANS)
+                {
+                    os << "R: " << polar.r << " Theta: " << polar.theta << " Radians";
+                    return os;
+                }
                 os << "R: " << polar.r << " Theta: " << polar.theta * 57.2957795 << " Degrees";
                 return os;
             }
@@ -0,0 +1,289 @@
+#pragma once
+#include <cmath>
+#include <complex>
+#include <ostream>
+#include <vector>
+#include "circuits2.hpp"
+namespace Hugh
+{
+    namespace Circuits2
+    {
+        // Many phasors in rectangular form, real and imaginary parts in their own arrays
+        // so every loop below runs straight down memory and vectorizes
+        struct PhasorArray
+        {
+            std::vector<double> re;
+            std::vector<double> im;
+            PhasorArray() = default;
+            explicit PhasorArray(std::size_t n) : re(n), im(n) {}
+            explicit PhasorArray(const std::vector<std::complex<double>> &from) : re(from.size()), im(from.size())
+            {
+                for (std::size_t i = 0; i < from.size(); i++)
+                {
+                    re[i] = from[i].real();
+                    im[i] = from[i].imag();
+                }
+            }
+            std::size_t size() const
+            {
+                return re.size();
+            }
+            void resize(std::size_t n)
+            {
+                re.resize(n);
+                im.resize(n);
+            }
+            std::complex<double> operator[](std::size_t i) const
+            {
+                return {re[i], im[i]};
+            }
+        };
+        // Same thing in polar form, theta in radians
+        struct PolarArray
+        {
+            std::vector<double> r;
+            std::vector<double> theta;
+            PolarArray() = default;
+            explicit PolarArray(std::size_t n) : r(n), theta(n) {}
+            std::size_t size() const
+            {
+                return r.size();
+            }
+            void resize(std::size_t n)
+            {
+                r.resize(n);
+                theta.resize(n);
+            }
+            polar_form operator[](std::size_t i) const
+            {
+                return polar_form(r[i], theta[i]);
+            }
+        };
+        // std::atan2, std::sin and std::cos are library calls that keep a loop scalar, these two are only arithmetic
+        // and selects so the loops calling them vectorize. Both stay within a few ulp of the library functions
+        // atan2 over every quadrant, on the axes and at +-0, with atan2(+-inf, +-inf) the one case giving NaN
+        // atan(t) for t = min / max by the Cephes rational approximation, which is good to 1 ulp on |t| <= 0.66,
+        // larger ratios go through atan(t) = pi / 4 + atan((t - 1) / (t + 1))
+        inline double phasorAtan2(double y, double x)
+        {
+            double ax = std::fabs(x);
+            double ay = std::fabs(y);
+            double small = ay < ax ? ay : ax;
+            double large = ay < ax ? ax : ay;
+            // Every choice below is a multiply by a 0 / 1 or -1 / 1 taken off copysign instead of a branch,
+            // floating point arithmetic under a condition could trap so the compiler would keep the loop scalar
+            double ratio = small / (large + static_cast<double>(large == 0));
+            double shift = 0.5 - 0.5 * std::copysign(1.0, 0.66 - ratio);
+            double t = (ratio - shift) / (1 + shift * ratio);
+            double z = t * t;
+            double P = (((-8.750608600031904122785e-1 * z - 1.615753718733365076637e1) * z - 7.500855792314704667340e1) * z -
+                        1.228866684490136173410e2) * z - 6.485021904942025371773e1;
+            double Q = ((((z + 2.485846490142306297962e1) * z + 1.650270098316988542046e2) * z + 4.328810604912902668951e2) * z +
+                        4.853903996359136964868e2) * z + 1.945506571482613964425e2;
+            double series = 1 + z * P / Q;
+            double angle = t * series + shift * (0.78539816339744831 + 3.061616997868383e-17);
+            double steep = std::copysign(1.0, ax - ay);
+            angle = 0.78539816339744831 * (1 - steep) + steep * angle;
+            double front = std::copysign(1.0, x);
+            angle = 1.5707963267948966 * (1 - front) + front * angle;
+            return std::copysign(angle, y);
+        }
+        // theta = k * pi / 2 + r with |r| <= pi / 4, pi / 2 taken off in three parts so r stays exact for |theta| up to
+        // phasorSinCosRange. k is rounded by way of an int, which -ffast-math can't fold away, and k & 3 is the quadrant
+        // Past the range (and for NaN) theta is taken as 0 so the loop stays branch free, callers redo those with the library
+        constexpr double phasorSinCosRange = 1e6;
+        inline void phasorSinCos(double theta, double &sine, double &cosine)
+        {
+#ifdef __FAST_MATH__
+            // -ffast-math merges the three parts back into one multiply by pi / 2, which is off by thousands of ulp by
+            // |theta| = 1e4, but it also lets the library sin and cos vectorize (glibc's libmvec), so they're used instead
+            sine = std::sin(theta);
+            cosine = std::cos(theta);
+#else
+            // +-0 rather than a plain 0 out of range, a constant there lets the compiler split the loop on it
+            double reduced = std::fabs(theta) <= phasorSinCosRange ? theta : std::copysign(0.0, theta);
+            double scaled = reduced * 0.63661977236758134;
+            int k = static_cast<int>(scaled + std::copysign(0.5, scaled));
+            int quadrant = k & 3;
+            double r = reduced - k * 1.57079632673412561417e+00;
+            r = r - k * 6.07710050630396597660e-11;
+            r = r - k * 2.02226624871116645580e-21;
+            double z = r * r;
+            double s = r + r * z * (-1.0 / 6 + z * (1.0 / 120 + z * (-1.0 / 5040 + z * (1.0 / 362880 + z * (-1.0 / 39916800 +
+                                  z * (1.0 / 6227020800 + z * (-1.0 / 1307674368000 + z * (1.0 / 355687428096000))))))));
+            double c = 1 - z / 2 + z * z * (1.0 / 24 + z * (-1.0 / 720 + z * (1.0 / 40320 + z * (-1.0 / 3628800 + z * (1.0 / 479001600 +
+                                  z * (-1.0 / 87178291200 + z * (1.0 / 20922789888000)))))));
+            bool swap = (quadrant & 1) != 0;
+            double sineOut = swap ? c : s;
+            double cosineOut = swap ? s : c;
+            sine = (quadrant & 2) != 0 ? -sineOut : sineOut;
+            cosine = quadrant == 1 || quadrant == 2 ? -cosineOut : cosineOut;
+#endif
+        }
+        // atan2 keeps the quadrant and gives +-pi/2 for purely imaginary values instead of dividing by zero
+        // std::sqrt has an errno branch unless built with -fno-math-errno, so it gets its own loop and doesn't hold up the angles
+        PolarArray toPolar(const PhasorArray &from)
+        {
+            std::size_t n = from.size();
+            PolarArray returnval(n);
+            const double *re = from.re.data();
+            const double *im = from.im.data();
+            double *r = returnval.r.data();
+            double *theta = returnval.theta.data();
+            for (std::size_t i = 0; i < n; i++)
+            {
+                r[i] = std::sqrt(re[i] * re[i] + im[i] * im[i]);
+            }
+            for (std::size_t i = 0; i < n; i++)
+            {
+                theta[i] = phasorAtan2(im[i], re[i]);
+            }
+            return returnval;
+        }
+        // Angles past phasorSinCosRange, inf and NaN come out of the vector loop wrong and get redone with std::sin and std::cos
+        PhasorArray toRect(const PolarArray &from)
+        {
+            std::size_t n = from.size();
+            PhasorArray returnval(n);
+            const double *r = from.r.data();
+            const double *theta = from.theta.data();
+            double *re = returnval.re.data();
+            double *im = returnval.im.data();
+            for (std::size_t i = 0; i < n; i++)
+            {
+                double sine;
+                double cosine;
+                phasorSinCos(theta[i], sine, cosine);
+                re[i] = r[i] * cosine;
+                im[i] = r[i] * sine;
+            }
+            for (std::size_t i = 0; i < n; i++)
+            {
+                if (!(std::fabs(theta[i]) <= phasorSinCosRange))
+                {
+                    re[i] = r[i] * std::cos(theta[i]);
+                    im[i] = r[i] * std::sin(theta[i]);
+                }
+            }
+            return returnval;
+        }
+        // Polar multiply and divide are one multiply and one add each, no trig
+        PolarArray multiply(const PolarArray &a, const PolarArray &b)
+        {
+            PolarArray returnval(a.size());
+            for (std::size_t i = 0; i < a.size(); i++)
+            {
+                returnval.r[i] = a.r[i] * b.r[i];
+                returnval.theta[i] = a.theta[i] + b.theta[i];
+            }
+            return returnval;
+        }
+        PolarArray divide(const PolarArray &a, const PolarArray &b)
+        {
+            PolarArray returnval(a.size());
+            for (std::size_t i = 0; i < a.size(); i++)
+            {
+                returnval.r[i] = a.r[i] / b.r[i];
+                returnval.theta[i] = a.theta[i] - b.theta[i];
+            }
+            return returnval;
+        }
+        PolarArray conjugate(const PolarArray &a)
+        {
+            PolarArray returnval(a.size());
+            for (std::size_t i = 0; i < a.size(); i++)
+            {
+                returnval.r[i] = a.r[i];
+                returnval.theta[i] = -a.theta[i];
+            }
+            return returnval;
+        }
+        // Rectangular versions, for when the data is already rectangular there's no reason to convert
+        PhasorArray multiply(const PhasorArray &a, const PhasorArray &b)
+        {
+            PhasorArray returnval(a.size());
+            for (std::size_t i = 0; i < a.size(); i++)
+            {
+                returnval.re[i] = a.re[i] * b.re[i] - a.im[i] * b.im[i];
+                returnval.im[i] = a.re[i] * b.im[i] + a.im[i] * b.re[i];
+            }
+            return returnval;
+        }
+        PhasorArray divide(const PhasorArray &a, const PhasorArray &b)
+        {
+            PhasorArray returnval(a.size());
+            for (std::size_t i = 0; i < a.size(); i++)
+            {
+                double bottom = b.re[i] * b.re[i] + b.im[i] * b.im[i];
+                returnval.re[i] = (a.re[i] * b.re[i] + a.im[i] * b.im[i]) / bottom;
+                returnval.im[i] = (a.im[i] * b.re[i] - a.re[i] * b.im[i]) / bottom;
+            }
+            return returnval;
+        }
+        PhasorArray conjugate(const PhasorArray &a)
+        {
+            PhasorArray returnval(a.size());
+            for (std::size_t i = 0; i < a.size(); i++)
+            {
+                returnval.re[i] = a.re[i];
+                returnval.im[i] = -a.im[i];
+            }
+            return returnval;
+        }
+        // S = V * conj(I)
+        PhasorArray complexPower(const PhasorArray &V, const PhasorArray &I)
+        {
+            PhasorArray returnval(V.size());
+            for (std::size_t i = 0; i < V.size(); i++)
+            {
+                returnval.re[i] = V.re[i] * I.re[i] + V.im[i] * I.im[i];
+                returnval.im[i] = V.im[i] * I.re[i] - V.re[i] * I.im[i];
+            }
+            return returnval;
+        }
+        // transfer() at every frequency, the R * L * C out front cancels, which leaves
+        // H = a / (a + jb) with a = 1 / (LC) - w^2 and b = w / (RC)
+        PhasorArray transfer(const std::vector<double> &frequencies, double R, double L, double C)
+        {
+            PhasorArray returnval(frequencies.size());
+            const double *w = frequencies.data();
+            double resonance = 1 / (L * C);
+            double RC = R * C;
+            for (std::size_t i = 0; i < frequencies.size(); i++)
+            {
+                double a = resonance - w[i] * w[i];
+                double b = w[i] / RC;
+                double bottom = a * a + b * b;
+                returnval.re[i] = a * a / bottom;
+                returnval.im[i] = -a * b / bottom;
+            }
+            return returnval;
+        }
+        // impedence(w, R1, R2, L1, L2, k, ZL) at every frequency: R1 + jwL1 + w^2 M^2 / (R2 + jwL2 + ZL)
+        PhasorArray impedence(const std::vector<double> &frequencies, double R1, double R2, double L1, double L2, double k,
+                              std::complex<double> ZL)
+        {
+            PhasorArray returnval(frequencies.size());
+            const double *w = frequencies.data();
+            double M2 = k * k * L1 * L2;
+            double loopRe = R2 + ZL.real();
+            double ZLim = ZL.imag();
+            for (std::size_t i = 0; i < frequencies.size(); i++)
+            {
+                double loopIm = w[i] * L2 + ZLim;
+                double top = w[i] * w[i] * M2 / (loopRe * loopRe + loopIm * loopIm);
+                returnval.re[i] = R1 + top * loopRe;
+                returnval.im[i] = w[i] * L1 - top * loopIm;
+            }
+            return returnval;
+        }
+        std::ostream &operator<<(std::ostream &os, const PolarArray &polar)
+        {
+            for (std::size_t i = 0; i < polar.size(); i++)
+            {
+                os << polar[i] << std::endl;
+            }
+            return os;
+        }
+    }
+}
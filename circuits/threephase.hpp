@@ -0,0 +1,556 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <map>
+#include <ostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "circuits2.hpp"
+#include "scheduler.hpp"
+namespace Hugh
+{
+    namespace Circuits2
+    {
+        // One value per phase, a, b, c
+        using Phase3 = std::array<std::complex<double>, 3>;
+        // Rows are phases, off diagonals are the mutual impedances between phases
+        using Impedance3 = std::array<Phase3, 3>;
+        Impedance3 diagonalImpedance(std::complex<double> Z)
+        {
+            Impedance3 returnval = {};
+            returnval[0][0] = returnval[1][1] = returnval[2][2] = Z;
+            return returnval;
+        }
+        // a at angle, b lags by 120 degrees, c leads by 120 degrees
+        Phase3 balancedPhases(double magnitude, double angle)
+        {
+            const double shift = 2.0943951023931957;
+            return {std::polar(magnitude, angle), std::polar(magnitude, angle - shift), std::polar(magnitude, angle + shift)};
+        }
+        Impedance3 invert3(const Impedance3 &m)
+        {
+            Impedance3 returnval;
+            returnval[0][0] = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+            returnval[0][1] = m[0][2] * m[2][1] - m[0][1] * m[2][2];
+            returnval[0][2] = m[0][1] * m[1][2] - m[0][2] * m[1][1];
+            returnval[1][0] = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+            returnval[1][1] = m[0][0] * m[2][2] - m[0][2] * m[2][0];
+            returnval[1][2] = m[0][2] * m[1][0] - m[0][0] * m[1][2];
+            returnval[2][0] = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+            returnval[2][1] = m[0][1] * m[2][0] - m[0][0] * m[2][1];
+            returnval[2][2] = m[0][0] * m[1][1] - m[0][1] * m[1][0];
+            std::complex<double> det = m[0][0] * returnval[0][0] + m[0][1] * returnval[1][0] + m[0][2] * returnval[2][0];
+            for (Phase3 &row : returnval)
+            {
+                for (std::complex<double> &v : row)
+                {
+                    v /= det;
+                }
+            }
+            return returnval;
+        }
+        // Largest magnitude of any entry
+        double largest3(const Impedance3 &m)
+        {
+            double returnval = 0;
+            for (const Phase3 &row : m)
+            {
+                for (const std::complex<double> &v : row)
+                {
+                    returnval = std::max(returnval, std::abs(v));
+                }
+            }
+            return returnval;
+        }
+        Phase3 multiply3(const Impedance3 &m, const Phase3 &v)
+        {
+            Phase3 returnval;
+            for (int i = 0; i < 3; i++)
+            {
+                returnval[i] = m[i][0] * v[0] + m[i][1] * v[1] + m[i][2] * v[2];
+            }
+            return returnval;
+        }
+        Impedance3 multiply3(const Impedance3 &a, const Impedance3 &b)
+        {
+            Impedance3 returnval;
+            for (int i = 0; i < 3; i++)
+            {
+                for (int j = 0; j < 3; j++)
+                {
+                    returnval[i][j] = a[i][0] * b[0][j] + a[i][1] * b[1][j] + a[i][2] * b[2][j];
+                }
+            }
+            return returnval;
+        }
+        enum class LoadConnection
+        {
+            WYE,
+            DELTA
+        };
+        enum class LoadModel
+        {
+            CONSTANTPOWER,
+            CONSTANTIMPEDANCE
+        };
+        // For WYE value is per phase to neutral, for DELTA it's per branch ab, bc, ca
+        // CONSTANTPOWER takes value as S in VA, CONSTANTIMPEDANCE takes value as Z in ohms
+        struct ThreePhaseLoad
+        {
+            std::size_t bus;
+            LoadConnection connection;
+            LoadModel model;
+            Phase3 value;
+        };
+        struct ThreePhaseLine
+        {
+            std::size_t from;
+            std::size_t to;
+            Impedance3 Z;
+        };
+        // Ideal transformer on each phase, from is the primary side
+        // The series impedances are folded onto the primary with the ideal transformer impedence helper
+        struct ThreePhaseTransformer
+        {
+            std::size_t from;
+            std::size_t to;
+            Value primary;
+            Value secondary;
+            double primaryTurns;
+            double secondaryTurns;
+            std::complex<double> Zprimary;
+            std::complex<double> Zsecondary;
+            double ratio() const
+            {
+                double N = secondaryTurns / primaryTurns;
+                return primary != secondary ? -N : N;
+            }
+            std::complex<double> referredImpedence() const
+            {
+                return impedence(primary, secondary, primaryTurns, secondaryTurns, Zprimary, Zsecondary);
+            }
+        };
+        // Bus 0 is the source, its voltages are fixed, every other bus gets solved
+        struct ThreePhaseNetwork
+        {
+            std::size_t buses;
+            Phase3 source;
+            std::vector<ThreePhaseLine> lines;
+            std::vector<ThreePhaseTransformer> transformers;
+            std::vector<ThreePhaseLoad> loads;
+        };
+        // Block sparse LU of the admittance matrix with the source bus taken out, done once per network
+        // Buses are eliminated in minimum degree order, for a radial feeder that's always a leaf so nothing fills in
+        // lower[k] holds Y_ik * Y_kk^-1 and upper[k] holds Y_kj for the buses still left when k went
+        struct ThreePhaseFactor
+        {
+            std::vector<std::size_t> order;
+            std::vector<Impedance3> pivotInverse;
+            std::vector<std::vector<std::pair<std::size_t, Impedance3>>> lower;
+            std::vector<std::vector<std::pair<std::size_t, Impedance3>>> upper;
+            // b is indexed by bus, bus 0 is ignored
+            std::vector<Phase3> solve(std::vector<Phase3> b) const
+            {
+                for (std::size_t k : order)
+                {
+                    for (const auto &e : lower[k])
+                    {
+                        Phase3 part = multiply3(e.second, b[k]);
+                        for (int p = 0; p < 3; p++)
+                        {
+                            b[e.first][p] -= part[p];
+                        }
+                    }
+                }
+                for (auto k = order.rbegin(); k != order.rend(); ++k)
+                {
+                    Phase3 rest = b[*k];
+                    for (const auto &e : upper[*k])
+                    {
+                        Phase3 part = multiply3(e.second, b[e.first]);
+                        for (int p = 0; p < 3; p++)
+                        {
+                            rest[p] -= part[p];
+                        }
+                    }
+                    b[*k] = multiply3(pivotInverse[*k], rest);
+                }
+                return b;
+            }
+        };
+        // Block sparse nodal admittance matrix, each entry is the 3x3 coupling between two buses
+        // branches[i] lists every bus one line or transformer away from i, with what V_i gets scaled by to get there
+        struct ThreePhaseAdmittance
+        {
+            std::vector<Impedance3> diagonal;
+            std::vector<std::vector<std::pair<std::size_t, Impedance3>>> offDiagonal;
+            std::vector<std::vector<std::pair<std::size_t, double>>> branches;
+            ThreePhaseFactor factor;
+            void add(std::size_t i, std::size_t j, const Impedance3 &Y, std::complex<double> scale)
+            {
+                Impedance3 &target = i == j ? diagonal[i] : entry(i, j);
+                for (int r = 0; r < 3; r++)
+                {
+                    for (int c = 0; c < 3; c++)
+                    {
+                        target[r][c] += scale * Y[r][c];
+                    }
+                }
+            }
+            Impedance3 &entry(std::size_t i, std::size_t j)
+            {
+                for (auto &e : offDiagonal[i])
+                {
+                    if (e.first == j)
+                    {
+                        return e.second;
+                    }
+                }
+                offDiagonal[i].push_back({j, Impedance3{}});
+                return offDiagonal[i].back().second;
+            }
+            Phase3 row(std::size_t i, const std::vector<Phase3> &V, bool withDiagonal) const
+            {
+                Phase3 returnval = withDiagonal ? multiply3(diagonal[i], V[i]) : Phase3{};
+                for (const auto &e : offDiagonal[i])
+                {
+                    Phase3 part = multiply3(e.second, V[e.first]);
+                    for (int p = 0; p < 3; p++)
+                    {
+                        returnval[p] += part[p];
+                    }
+                }
+                return returnval;
+            }
+        };
+        // Throws std::runtime_error if some bus has no path back to the source, its pivot is then zero or has
+        // cancelled down to round off compared to the bus's own admittance
+        ThreePhaseFactor factorAdmittance(const ThreePhaseAdmittance &Y)
+        {
+            std::size_t buses = Y.diagonal.size();
+            ThreePhaseFactor returnval;
+            returnval.pivotInverse.resize(buses);
+            returnval.lower.resize(buses);
+            returnval.upper.resize(buses);
+            std::vector<std::map<std::size_t, Impedance3>> rows(buses);
+            std::vector<std::set<std::size_t>> adjacent(buses);
+            for (std::size_t i = 1; i < buses; i++)
+            {
+                rows[i][i] = Y.diagonal[i];
+                for (const auto &e : Y.offDiagonal[i])
+                {
+                    if (e.first != 0)
+                    {
+                        rows[i][e.first] = e.second;
+                        adjacent[i].insert(e.first);
+                        adjacent[e.first].insert(i);
+                    }
+                }
+            }
+            std::set<std::pair<std::size_t, std::size_t>> byDegree;
+            for (std::size_t i = 1; i < buses; i++)
+            {
+                byDegree.insert({adjacent[i].size(), i});
+            }
+            while (!byDegree.empty())
+            {
+                std::size_t k = byDegree.begin()->second;
+                byDegree.erase(byDegree.begin());
+                returnval.order.push_back(k);
+                const Impedance3 &pivot = rows[k][k];
+                double size = largest3(pivot);
+                Impedance3 pivotInverse = invert3(pivot);
+                if (!(size > 1e-10 * largest3(Y.diagonal[k])) || !std::isfinite(largest3(pivotInverse)))
+                {
+                    throw std::runtime_error("factorAdmittance: bus " + std::to_string(k) + " has no path to the source");
+                }
+                returnval.pivotInverse[k] = pivotInverse;
+                for (std::size_t i : adjacent[k])
+                {
+                    Impedance3 L = multiply3(rows[i][k], pivotInverse);
+                    returnval.lower[k].push_back({i, L});
+                    returnval.upper[k].push_back({i, rows[k][i]});
+                    for (std::size_t j : adjacent[k])
+                    {
+                        Impedance3 update = multiply3(L, rows[k][j]);
+                        Impedance3 &target = rows[i][j];
+                        for (int r = 0; r < 3; r++)
+                        {
+                            for (int c = 0; c < 3; c++)
+                            {
+                                target[r][c] -= update[r][c];
+                            }
+                        }
+                    }
+                    rows[i].erase(k);
+                }
+                // What's left of k's neighbours all see each other now
+                for (std::size_t i : adjacent[k])
+                {
+                    byDegree.erase({adjacent[i].size(), i});
+                    adjacent[i].erase(k);
+                    for (std::size_t j : adjacent[k])
+                    {
+                        if (j != i)
+                        {
+                            adjacent[i].insert(j);
+                        }
+                    }
+                    byDegree.insert({adjacent[i].size(), i});
+                }
+                rows[k].clear();
+            }
+            return returnval;
+        }
+        ThreePhaseAdmittance buildAdmittance(const ThreePhaseNetwork &network)
+        {
+            ThreePhaseAdmittance returnval;
+            returnval.diagonal.assign(network.buses, Impedance3{});
+            returnval.offDiagonal.resize(network.buses);
+            returnval.branches.resize(network.buses);
+            for (const ThreePhaseLine &line : network.lines)
+            {
+                returnval.branches[line.from].push_back({line.to, 1});
+                returnval.branches[line.to].push_back({line.from, 1});
+                Impedance3 Y = invert3(line.Z);
+                returnval.add(line.from, line.from, Y, 1);
+                returnval.add(line.to, line.to, Y, 1);
+                returnval.add(line.from, line.to, Y, -1);
+                returnval.add(line.to, line.from, Y, -1);
+            }
+            for (const ThreePhaseTransformer &transformer : network.transformers)
+            {
+                double a = transformer.ratio();
+                returnval.branches[transformer.from].push_back({transformer.to, a});
+                returnval.branches[transformer.to].push_back({transformer.from, 1 / a});
+                Impedance3 Y = diagonalImpedance(1.0 / transformer.referredImpedence());
+                returnval.add(transformer.from, transformer.from, Y, 1);
+                returnval.add(transformer.to, transformer.to, Y, 1 / (a * a));
+                returnval.add(transformer.from, transformer.to, Y, -1 / a);
+                returnval.add(transformer.to, transformer.from, Y, -1 / a);
+            }
+            returnval.factor = factorAdmittance(returnval);
+            return returnval;
+        }
+        // Line currents drawn by a load, for DELTA the branch currents get turned into line currents
+        Phase3 loadCurrent(const ThreePhaseLoad &load, const Phase3 &V)
+        {
+            Phase3 across = V;
+            if (load.connection == LoadConnection::DELTA)
+            {
+                across = {V[0] - V[1], V[1] - V[2], V[2] - V[0]};
+            }
+            Phase3 branch;
+            for (int p = 0; p < 3; p++)
+            {
+                if (load.model == LoadModel::CONSTANTPOWER)
+                {
+                    branch[p] = across[p] == 0.0 ? 0.0 : std::conj(load.value[p] / across[p]);
+                }
+                else
+                {
+                    branch[p] = across[p] / load.value[p];
+                }
+            }
+            if (load.connection == LoadConnection::DELTA)
+            {
+                return {branch[0] - branch[2], branch[1] - branch[0], branch[2] - branch[1]};
+            }
+            return branch;
+        }
+        struct ThreePhaseResult
+        {
+            std::vector<Phase3> voltages;
+            // Current leaving the from bus
+            std::vector<Phase3> lineCurrents;
+            std::vector<Phase3> transformerCurrents;
+            std::vector<Phase3> loadCurrents;
+            // S = V * conj(I) per phase, for DELTA loads this is per phase of the line feeding it
+            std::vector<Phase3> loadPower;
+            Phase3 sourceCurrent;
+            Phase3 sourcePower;
+            int iterations = 0;
+            bool converged = false;
+            friend std::ostream &operator<<(std::ostream &os, const ThreePhaseResult &result)
+            {
+                const char *names = "abc";
+                for (std::size_t i = 0; i < result.voltages.size(); i++)
+                {
+                    os << "Bus " << i << std::endl;
+                    for (int p = 0; p < 3; p++)
+                    {
+                        os << "  V" << names[p] << ": " << polar_form(result.voltages[i][p]) << std::endl;
+                    }
+                }
+                for (int p = 0; p < 3; p++)
+                {
+                    os << "Source S" << names[p] << ": " << result.sourcePower[p] << std::endl;
+                }
+                os << (result.converged ? "Converged" : "Did not converge") << " after " << result.iterations << " iterations" << std::endl;
+                return os;
+            }
+        };
+        // Flat start, walk out from the source copying voltages over lines and scaling them across transformers
+        std::vector<Phase3> flatStart(const ThreePhaseNetwork &network, const ThreePhaseAdmittance &Y)
+        {
+            std::vector<Phase3> returnval(network.buses, network.source);
+            std::vector<bool> seen(network.buses, false);
+            std::vector<std::size_t> stack = {0};
+            seen[0] = true;
+            while (!stack.empty())
+            {
+                std::size_t bus = stack.back();
+                stack.pop_back();
+                for (const auto &branch : Y.branches[bus])
+                {
+                    std::size_t next = branch.first;
+                    if (seen[next])
+                    {
+                        continue;
+                    }
+                    seen[next] = true;
+                    for (int p = 0; p < 3; p++)
+                    {
+                        returnval[next][p] = returnval[bus][p] * branch.second;
+                    }
+                    stack.push_back(next);
+                }
+            }
+            return returnval;
+        }
+        // Implicit Z-bus fixed point, with L the solved buses and S the source
+        // Y_LL * V_L = -(Y_LS * V_S + I(V_L)), the loads are re-evaluated at the last voltages and the factored Y_LL
+        // is reused every iteration, so the iteration count doesn't grow with the number of buses
+        // tolerance is on the largest per unit change of any phase voltage in an iteration
+        // A voltage that goes to inf or NaN, a load beyond what the network can carry, stops it unconverged
+        ThreePhaseResult solveThreePhase(const ThreePhaseNetwork &network, const ThreePhaseAdmittance &Y,
+                                         double tolerance = 1e-9, int maxIterations = 1000)
+        {
+            ThreePhaseResult returnval;
+            returnval.voltages = flatStart(network, Y);
+            std::vector<Phase3> &V = returnval.voltages;
+            V[0] = network.source;
+            std::vector<Phase3> fromSource(network.buses);
+            for (std::size_t i = 1; i < network.buses; i++)
+            {
+                for (const auto &e : Y.offDiagonal[i])
+                {
+                    if (e.first == 0)
+                    {
+                        fromSource[i] = multiply3(e.second, V[0]);
+                    }
+                }
+            }
+            std::vector<Phase3> rhs(network.buses);
+            for (returnval.iterations = 1; returnval.iterations <= maxIterations; returnval.iterations++)
+            {
+                rhs = fromSource;
+                for (const ThreePhaseLoad &load : network.loads)
+                {
+                    if (load.bus == 0)
+                    {
+                        continue;
+                    }
+                    Phase3 I = loadCurrent(load, V[load.bus]);
+                    for (int p = 0; p < 3; p++)
+                    {
+                        rhs[load.bus][p] += I[p];
+                    }
+                }
+                for (Phase3 &r : rhs)
+                {
+                    for (std::complex<double> &v : r)
+                    {
+                        v = -v;
+                    }
+                }
+                std::vector<Phase3> next = Y.factor.solve(rhs);
+                double change = 0;
+                for (std::size_t i = 1; i < network.buses; i++)
+                {
+                    for (int p = 0; p < 3; p++)
+                    {
+                        double scale = std::max(std::abs(next[i][p]), 1e-12);
+                        double step = std::abs(next[i][p] - V[i][p]) / scale;
+                        change = std::isnan(step) || step > change ? step : change;
+                    }
+                    V[i] = next[i];
+                }
+                if (!std::isfinite(change))
+                {
+                    break;
+                }
+                if (change < tolerance)
+                {
+                    returnval.converged = true;
+                    break;
+                }
+            }
+            returnval.iterations = std::min(returnval.iterations, maxIterations);
+            for (const ThreePhaseLine &line : network.lines)
+            {
+                Phase3 drop;
+                for (int p = 0; p < 3; p++)
+                {
+                    drop[p] = V[line.from][p] - V[line.to][p];
+                }
+                returnval.lineCurrents.push_back(multiply3(invert3(line.Z), drop));
+            }
+            for (const ThreePhaseTransformer &transformer : network.transformers)
+            {
+                std::complex<double> y = 1.0 / transformer.referredImpedence();
+                double a = transformer.ratio();
+                Phase3 I;
+                for (int p = 0; p < 3; p++)
+                {
+                    I[p] = y * (V[transformer.from][p] - V[transformer.to][p] / a);
+                }
+                returnval.transformerCurrents.push_back(I);
+            }
+            returnval.sourceCurrent = Y.row(0, V, true);
+            for (const ThreePhaseLoad &load : network.loads)
+            {
+                Phase3 I = loadCurrent(load, V[load.bus]);
+                Phase3 S;
+                for (int p = 0; p < 3; p++)
+                {
+                    S[p] = V[load.bus][p] * std::conj(I[p]);
+                    if (load.bus == 0)
+                    {
+                        returnval.sourceCurrent[p] += I[p];
+                    }
+                }
+                returnval.loadCurrents.push_back(I);
+                returnval.loadPower.push_back(S);
+            }
+            for (int p = 0; p < 3; p++)
+            {
+                returnval.sourcePower[p] = V[0][p] * std::conj(returnval.sourceCurrent[p]);
+            }
+            return returnval;
+        }
+        ThreePhaseResult solveThreePhase(const ThreePhaseNetwork &network, double tolerance = 1e-9, int maxIterations = 1000)
+        {
+            return solveThreePhase(network, buildAdmittance(network), tolerance, maxIterations);
+        }
+        // Contingency studies, same lines and transformers, every scenario swaps in its own set of loads
+        // The admittance matrix is built and factored once and shared, one pool task per scenario
+        std::vector<ThreePhaseResult> solveThreePhaseScenarios(const ThreePhaseNetwork &network,
+                                                               const std::vector<std::vector<ThreePhaseLoad>> &scenarios,
+                                                               double tolerance = 1e-9, int maxIterations = 1000,
+                                                               Util::ThreadPool &pool = Util::sharedPool())
+        {
+            ThreePhaseAdmittance Y = buildAdmittance(network);
+            return pool.wait(pool.map(scenarios.size(), [&](std::size_t s)
+                                      {
+                                          ThreePhaseNetwork scenario = network;
+                                          scenario.loads = scenarios[s];
+                                          return solveThreePhase(scenario, Y, tolerance, maxIterations); },
+                                      Util::TaskPriority::NORMAL, Util::CancellationToken(), 1));
+        }
+    }
+}
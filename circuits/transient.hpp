@@ -0,0 +1,409 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "resultcache.hpp"
+#include "scheduler.hpp"
+namespace Hugh
+{
+    namespace Circuits2
+    {
+        // dx/dt = A x + B u, y = C x, matrices are row major
+        // damping is the damping factor when it's a single second order section, NaN for cascades
+        struct StateSpace
+        {
+            std::size_t n;
+            std::vector<double> A;
+            std::vector<double> B;
+            std::vector<double> C;
+            double damping = std::numeric_limits<double>::quiet_NaN();
+        };
+        // Driven by a voltage source, states are inductor current and capacitor voltage, output is the capacitor voltage
+        StateSpace seriesRLC(double R, double L, double C)
+        {
+            StateSpace returnval;
+            returnval.n = 2;
+            returnval.A = {-R / L, -1 / L, 1 / C, 0};
+            returnval.B = {1 / L, 0};
+            returnval.C = {0, 1};
+            returnval.damping = (R / 2) * std::sqrt(C / L);
+            return returnval;
+        }
+        // Driven by a current source, states are capacitor voltage and inductor current, output is the inductor current
+        // The voltage settles back to 0 for a step so the inductor current is what shows overshoot
+        StateSpace parallelRLC(double R, double L, double C)
+        {
+            StateSpace returnval;
+            returnval.n = 2;
+            returnval.A = {-1 / (R * C), -1 / C, 1 / L, 0};
+            returnval.B = {1 / C, 0};
+            returnval.C = {0, 1};
+            returnval.damping = (1 / (2 * R)) * std::sqrt(L / C);
+            return returnval;
+        }
+        struct RLCSection
+        {
+            double R;
+            double L;
+            double C;
+        };
+        // Series RLC sections chained as a ladder, every section is driven by the capacitor before it and loads it
+        // States are i1, v1, i2, v2, ..., output is the last capacitor voltage
+        // Throws std::invalid_argument for an empty cascade
+        StateSpace cascadeRLC(const std::vector<RLCSection> &sections)
+        {
+            if (sections.empty())
+            {
+                throw std::invalid_argument("cascadeRLC: needs at least one section");
+            }
+            if (sections.size() == 1)
+            {
+                return seriesRLC(sections[0].R, sections[0].L, sections[0].C);
+            }
+            StateSpace returnval;
+            returnval.n = 2 * sections.size();
+            std::size_t n = returnval.n;
+            returnval.A.assign(n * n, 0);
+            returnval.B.assign(n, 0);
+            returnval.C.assign(n, 0);
+            for (std::size_t k = 0; k < sections.size(); k++)
+            {
+                std::size_t i = 2 * k;
+                std::size_t v = 2 * k + 1;
+                const RLCSection &s = sections[k];
+                returnval.A[i * n + i] = -s.R / s.L;
+                returnval.A[i * n + v] = -1 / s.L;
+                if (k == 0)
+                {
+                    returnval.B[i] = 1 / s.L;
+                }
+                else
+                {
+                    returnval.A[i * n + v - 2] = 1 / s.L;
+                }
+                returnval.A[v * n + i] = 1 / s.C;
+                if (k + 1 < sections.size())
+                {
+                    returnval.A[v * n + i + 2] = -1 / s.C;
+                }
+            }
+            returnval.C[n - 1] = 1;
+            return returnval;
+        }
+        std::vector<double> transientMultiply(const std::vector<double> &a, const std::vector<double> &b, std::size_t n)
+        {
+            std::vector<double> returnval(n * n, 0);
+            for (std::size_t i = 0; i < n; i++)
+            {
+                for (std::size_t k = 0; k < n; k++)
+                {
+                    double aik = a[i * n + k];
+                    for (std::size_t j = 0; j < n; j++)
+                    {
+                        returnval[i * n + j] += aik * b[k * n + j];
+                    }
+                }
+            }
+            return returnval;
+        }
+        // Scaling and squaring, the scaled matrix has norm below 1/2 so 20 Taylor terms is past double precision
+        std::vector<double> matrixExponential(std::vector<double> M, std::size_t n)
+        {
+            double norm = 0;
+            for (std::size_t i = 0; i < n; i++)
+            {
+                double row = 0;
+                for (std::size_t j = 0; j < n; j++)
+                {
+                    row += std::fabs(M[i * n + j]);
+                }
+                norm = std::max(norm, row);
+            }
+            int squarings = norm > 0.5 ? static_cast<int>(std::ceil(std::log2(norm / 0.5))) : 0;
+            double scale = std::ldexp(1.0, -squarings);
+            for (double &m : M)
+            {
+                m *= scale;
+            }
+            std::vector<double> returnval(n * n, 0);
+            std::vector<double> term(n * n, 0);
+            for (std::size_t i = 0; i < n; i++)
+            {
+                returnval[i * n + i] = 1;
+                term[i * n + i] = 1;
+            }
+            for (int k = 1; k <= 20; k++)
+            {
+                term = transientMultiply(term, M, n);
+                for (std::size_t i = 0; i < n * n; i++)
+                {
+                    term[i] /= k;
+                    returnval[i] += term[i];
+                }
+            }
+            for (int i = 0; i < squarings; i++)
+            {
+                returnval = transientMultiply(returnval, returnval, n);
+            }
+            return returnval;
+        }
+        // x[k + 1] = Phi x[k] + Gamma u[k], exact when u holds still over the step, which a step input does
+        // exp([[A, B], [0, 0]] * dt) = [[Phi, Gamma], [0, 1]] gives both from one exponential
+        struct DiscreteStateSpace
+        {
+            std::size_t n;
+            double dt;
+            std::vector<double> Phi;
+            std::vector<double> Gamma;
+            std::vector<double> C;
+        };
+        DiscreteStateSpace discretize(const StateSpace &system, double dt)
+        {
+            std::size_t n = system.n;
+            std::size_t m = n + 1;
+            std::vector<double> augmented(m * m, 0);
+            for (std::size_t i = 0; i < n; i++)
+            {
+                for (std::size_t j = 0; j < n; j++)
+                {
+                    augmented[i * m + j] = system.A[i * n + j] * dt;
+                }
+                augmented[i * m + n] = system.B[i] * dt;
+            }
+            std::vector<double> E = matrixExponential(augmented, m);
+            DiscreteStateSpace returnval;
+            returnval.n = n;
+            returnval.dt = dt;
+            returnval.Phi.resize(n * n);
+            returnval.Gamma.resize(n);
+            returnval.C = system.C;
+            for (std::size_t i = 0; i < n; i++)
+            {
+                for (std::size_t j = 0; j < n; j++)
+                {
+                    returnval.Phi[i * n + j] = E[i * m + j];
+                }
+                returnval.Gamma[i] = E[i * m + n];
+            }
+            return returnval;
+        }
+        // y for a constant input of 1 once everything settles, solves A x = -B with partial pivoting
+        double steadyStateGain(const StateSpace &system)
+        {
+            std::size_t n = system.n;
+            std::vector<double> A = system.A;
+            std::vector<double> x(n);
+            for (std::size_t i = 0; i < n; i++)
+            {
+                x[i] = -system.B[i];
+            }
+            for (std::size_t col = 0; col < n; col++)
+            {
+                std::size_t pivot = col;
+                for (std::size_t r = col + 1; r < n; r++)
+                {
+                    if (std::fabs(A[r * n + col]) > std::fabs(A[pivot * n + col]))
+                    {
+                        pivot = r;
+                    }
+                }
+                for (std::size_t j = 0; j < n; j++)
+                {
+                    std::swap(A[col * n + j], A[pivot * n + j]);
+                }
+                std::swap(x[col], x[pivot]);
+                for (std::size_t r = col + 1; r < n; r++)
+                {
+                    double factor = A[r * n + col] / A[col * n + col];
+                    for (std::size_t j = col; j < n; j++)
+                    {
+                        A[r * n + j] -= factor * A[col * n + j];
+                    }
+                    x[r] -= factor * x[col];
+                }
+            }
+            for (std::size_t col = n; col-- > 0;)
+            {
+                for (std::size_t j = col + 1; j < n; j++)
+                {
+                    x[col] -= A[col * n + j] * x[j];
+                }
+                x[col] /= A[col * n + col];
+            }
+            double returnval = 0;
+            for (std::size_t i = 0; i < n; i++)
+            {
+                returnval += system.C[i] * x[i];
+            }
+            return returnval;
+        }
+        enum class ResponseKind
+        {
+            STEP,
+            IMPULSE
+        };
+        // overshoot is a fraction of the final value, settlingTime is the last time y was outside band of it
+        // For an impulse the final value is 0 so the band is taken off the peak instead, and overshoot stays 0
+        // damping is the section's own for single sections, otherwise it's read back off the step overshoot
+        // as if the dominant poles were a second order pair (1 if the response never overshoots, 0 at 100% or more)
+        // An impulse run of a cascade has no overshoot to read it from, so damping is NaN there
+        struct ResponseMetrics
+        {
+            double finalValue = 0;
+            double peak = 0;
+            double peakTime = 0;
+            double overshoot = 0;
+            double settlingTime = 0;
+            double damping = 0;
+            std::size_t samples = 0;
+        };
+        // Runs samples steps of length dt, handing every chunk of outputs to sink(const double *, std::size_t count)
+        // Only one chunk is kept in memory, so the length of the run is only bounded by what the sink does with it
+        // Metrics need the whole run, so settlingTime is against the analytic final value rather than the last sample
+        template <class Sink>
+        ResponseMetrics simulateResponse(const StateSpace &system, ResponseKind kind, double dt, std::size_t samples, Sink &&sink,
+                                         std::size_t chunk = 1 << 16, double band = 0.02)
+        {
+            DiscreteStateSpace discrete = discretize(system, dt);
+            std::size_t n = discrete.n;
+            ResponseMetrics returnval;
+            returnval.samples = samples;
+            returnval.finalValue = kind == ResponseKind::STEP ? steadyStateGain(system) : 0;
+            std::vector<double> x(n, 0);
+            std::vector<double> next(n);
+            double u = kind == ResponseKind::STEP ? 1 : 0;
+            if (kind == ResponseKind::IMPULSE)
+            {
+                x = system.B;
+            }
+            std::vector<double> buffer(std::max<std::size_t>(1, std::min(chunk, samples)));
+            double extreme = 0;
+            std::size_t lastOutside = 0;
+            std::size_t filled = 0;
+            for (std::size_t k = 0; k < samples; k++)
+            {
+                double y = 0;
+                for (std::size_t i = 0; i < n; i++)
+                {
+                    y += discrete.C[i] * x[i];
+                }
+                if (std::fabs(y) > std::fabs(extreme))
+                {
+                    extreme = y;
+                    returnval.peakTime = k * dt;
+                }
+                double reference = kind == ResponseKind::STEP ? std::fabs(returnval.finalValue) : std::fabs(extreme);
+                if (std::fabs(y - returnval.finalValue) > band * reference)
+                {
+                    lastOutside = k + 1;
+                }
+                buffer[filled++] = y;
+                if (filled == buffer.size())
+                {
+                    sink(static_cast<const double *>(buffer.data()), filled);
+                    filled = 0;
+                }
+                for (std::size_t i = 0; i < n; i++)
+                {
+                    double total = discrete.Gamma[i] * u;
+                    for (std::size_t j = 0; j < n; j++)
+                    {
+                        total += discrete.Phi[i * n + j] * x[j];
+                    }
+                    next[i] = total;
+                }
+                std::swap(x, next);
+            }
+            if (filled > 0)
+            {
+                sink(static_cast<const double *>(buffer.data()), filled);
+            }
+            returnval.peak = extreme;
+            returnval.settlingTime = lastOutside * dt;
+            if (kind == ResponseKind::STEP && returnval.finalValue != 0)
+            {
+                returnval.overshoot = std::max(0.0, (extreme - returnval.finalValue) / returnval.finalValue);
+            }
+            returnval.damping = system.damping;
+            if (std::isnan(returnval.damping) && kind == ResponseKind::STEP)
+            {
+                // 9.8696... = pi^2, a second order pair never overshoots by 100% or more so that reads as undamped
+                double logOvershoot = std::log(returnval.overshoot);
+                returnval.damping = returnval.overshoot > 0 ? std::max(0.0, -logOvershoot / std::sqrt(9.869604401089358 + logOvershoot * logOvershoot)) : 1;
+            }
+            return returnval;
+        }
+        ResponseMetrics responseMetrics(const StateSpace &system, ResponseKind kind, double dt, std::size_t samples)
+        {
+            return simulateResponse(system, kind, dt, samples, [](const double *, std::size_t) {});
+        }
+        // Same as above, looked up in the on disk cache first, keyed on the whole system and the run
+        // An entry that isn't exactly one set of metrics long gets rerun and overwritten
+        ResponseMetrics responseMetrics(const StateSpace &system, ResponseKind kind, double dt, std::size_t samples,
+                                        Util::ResultCache &disk)
+        {
+            std::vector<double> params = {static_cast<double>(system.n), system.damping, static_cast<double>(kind), dt,
+                                          static_cast<double>(samples)};
+            params.insert(params.end(), system.A.begin(), system.A.end());
+            params.insert(params.end(), system.B.begin(), system.B.end());
+            params.insert(params.end(), system.C.begin(), system.C.end());
+            ResponseMetrics returnval;
+            std::optional<Util::CachedResult> stored = disk.find("transient.metrics", params);
+            if (stored && stored->size() == 7)
+            {
+                const Util::CachedResult &values = *stored;
+                returnval.finalValue = values[0];
+                returnval.peak = values[1];
+                returnval.peakTime = values[2];
+                returnval.overshoot = values[3];
+                returnval.settlingTime = values[4];
+                returnval.damping = values[5];
+                returnval.samples = static_cast<std::size_t>(values[6]);
+                return returnval;
+            }
+            returnval = responseMetrics(system, kind, dt, samples);
+            disk.store("transient.metrics", params,
+                       {returnval.finalValue, returnval.peak, returnval.peakTime, returnval.overshoot, returnval.settlingTime,
+                        returnval.damping, static_cast<double>(returnval.samples)});
+            return returnval;
+        }
+        // Raw native endian doubles, one per sample, written a chunk at a time
+        // Throws std::runtime_error if the file can't be opened or a write fails, the simulation stops at that chunk
+        ResponseMetrics streamResponse(const std::string &path, const StateSpace &system, ResponseKind kind, double dt,
+                                       std::size_t samples, std::size_t chunk = 1 << 16)
+        {
+            std::ofstream out(path, std::ios::binary);
+            if (!out)
+            {
+                throw std::runtime_error("streamResponse: can't open " + path);
+            }
+            ResponseMetrics returnval = simulateResponse(system, kind, dt, samples, [&](const double *data, std::size_t count)
+                                                         {
+                                                             out.write(reinterpret_cast<const char *>(data), count * sizeof(double));
+                                                             if (!out)
+                                                             {
+                                                                 throw std::runtime_error("streamResponse: write to " + path + " failed");
+                                                             } },
+                                                         chunk);
+            out.close();
+            if (!out)
+            {
+                throw std::runtime_error("streamResponse: write to " + path + " failed");
+            }
+            return returnval;
+        }
+        // Many component sets at once, only the metrics come back, one pool task per system
+        std::vector<ResponseMetrics> responseMetricsBatch(const std::vector<StateSpace> &systems, ResponseKind kind, double dt,
+                                                          std::size_t samples, Util::ThreadPool &pool = Util::sharedPool())
+        {
+            return pool.wait(pool.map(systems.size(), [&](std::size_t i)
+                                      { return responseMetrics(systems[i], kind, dt, samples); },
+                                      Util::TaskPriority::NORMAL, Util::CancellationToken(), 1));
+        }
+    }
+}
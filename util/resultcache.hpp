@@ -0,0 +1,378 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+namespace Hugh
+{
+    namespace Util
+    {
+        // FNV-1a over the kind name and the exact bits of every parameter, so 0.1 and 0.1000000001 are different keys
+        std::uint64_t resultCacheHash(const std::string &kind, const std::vector<double> &params)
+        {
+            std::uint64_t hash = 14695981039346656037ull;
+            auto mix = [&](const void *data, std::size_t size)
+            {
+                const unsigned char *bytes = static_cast<const unsigned char *>(data);
+                for (std::size_t i = 0; i < size; i++)
+                {
+                    hash = (hash ^ bytes[i]) * 1099511628211ull;
+                }
+            };
+            mix(kind.data(), kind.size());
+            mix("\0", 1);
+            mix(params.data(), params.size() * sizeof(double));
+            return hash;
+        }
+        // On disk: header, kind padded out to 8 bytes, the parameters, then the payload
+        // The whole key is stored so a hash collision reads as a miss instead of someone else's result
+        struct ResultCacheHeader
+        {
+            char magic[8];
+            std::uint64_t hash;
+            std::uint32_t kindLength;
+            std::uint32_t paramCount;
+            std::uint64_t payloadCount;
+        };
+        // A cached payload mapped straight out of its file, nothing gets parsed or copied
+        // The mapping stays good even if the file is evicted while it's held
+        class CachedResult
+        {
+        public:
+            CachedResult(void *mapping, std::size_t mappingSize, const double *payload, std::size_t count)
+                : mapping(mapping), mappingSize(mappingSize), payload(payload), count(count)
+            {
+            }
+            CachedResult(CachedResult &&other) noexcept
+                : mapping(other.mapping), mappingSize(other.mappingSize), payload(other.payload), count(other.count)
+            {
+                other.mapping = nullptr;
+            }
+            CachedResult &operator=(CachedResult &&other) noexcept
+            {
+                std::swap(mapping, other.mapping);
+                std::swap(mappingSize, other.mappingSize);
+                std::swap(payload, other.payload);
+                std::swap(count, other.count);
+                return *this;
+            }
+            CachedResult(const CachedResult &) = delete;
+            CachedResult &operator=(const CachedResult &) = delete;
+            ~CachedResult()
+            {
+                if (mapping != nullptr)
+                {
+                    munmap(mapping, mappingSize);
+                }
+            }
+            const double *data() const
+            {
+                return payload;
+            }
+            std::size_t size() const
+            {
+                return count;
+            }
+            const double *begin() const
+            {
+                return payload;
+            }
+            const double *end() const
+            {
+                return payload + count;
+            }
+            double operator[](std::size_t i) const
+            {
+                return payload[i];
+            }
+
+        private:
+            void *mapping;
+            std::size_t mappingSize;
+            const double *payload;
+            std::size_t count;
+        };
+        // Content addressed results in one directory, one file per key, POSIX only
+        // Writers build a temp file and rename it in, so other processes see either nothing or the whole result
+        // A hit bumps the file's mtime. The directory's .lock file is flocked around every rename and holds
+        // the running total of the .res files, so a store only scans the directory once that total is over maxBytes
+        // A scan recounts everything, deletes the oldest files until the total is under maxBytes, and deletes
+        // temp files over an hour old, which a writer that died before its rename leaves behind
+        class ResultCache
+        {
+        public:
+            ResultCache(std::string directory, std::uint64_t maxBytes) : directory(std::move(directory)), maxBytes(maxBytes)
+            {
+                mkdir(this->directory.c_str(), 0755);
+            }
+            std::optional<CachedResult> find(const std::string &kind, const std::vector<double> &params) const
+            {
+                std::string path = pathFor(resultCacheHash(kind, params));
+                int fd = open(path.c_str(), O_RDONLY);
+                if (fd < 0)
+                {
+                    return std::nullopt;
+                }
+                struct stat info;
+                if (fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(ResultCacheHeader))
+                {
+                    close(fd);
+                    return std::nullopt;
+                }
+                std::size_t size = info.st_size;
+                void *mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+                close(fd);
+                if (mapping == MAP_FAILED)
+                {
+                    return std::nullopt;
+                }
+                const char *base = static_cast<const char *>(mapping);
+                ResultCacheHeader header;
+                std::memcpy(&header, base, sizeof(header));
+                std::size_t kindBytes = padded(header.kindLength);
+                std::size_t expected = sizeof(header) + kindBytes + (header.paramCount + header.payloadCount) * sizeof(double);
+                const double *stored = reinterpret_cast<const double *>(base + sizeof(header) + kindBytes);
+                if (std::memcmp(header.magic, "HUGHRC1", 8) != 0 || expected != size || header.kindLength != kind.size() ||
+                    header.paramCount != params.size() || std::memcmp(base + sizeof(header), kind.data(), kind.size()) != 0 ||
+                    std::memcmp(stored, params.data(), params.size() * sizeof(double)) != 0)
+                {
+                    munmap(mapping, size);
+                    return std::nullopt;
+                }
+                utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+                return CachedResult(mapping, size, stored + header.paramCount, header.payloadCount);
+            }
+            void store(const std::string &kind, const std::vector<double> &params, const double *payload, std::size_t count)
+            {
+                std::uint64_t hash = resultCacheHash(kind, params);
+                std::string path = pathFor(hash);
+                std::string temp = path + ".tmp." + std::to_string(getpid()) + "." +
+                                   std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+                ResultCacheHeader header = {};
+                std::memcpy(header.magic, "HUGHRC1", 8);
+                header.hash = hash;
+                header.kindLength = static_cast<std::uint32_t>(kind.size());
+                header.paramCount = static_cast<std::uint32_t>(params.size());
+                header.payloadCount = count;
+                std::string kindBytes = kind;
+                kindBytes.resize(padded(kind.size()), '\0');
+                int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0)
+                {
+                    return;
+                }
+                bool ok = writeAll(fd, &header, sizeof(header)) && writeAll(fd, kindBytes.data(), kindBytes.size()) &&
+                          writeAll(fd, params.data(), params.size() * sizeof(double)) &&
+                          writeAll(fd, payload, count * sizeof(double));
+                close(fd);
+                if (!ok)
+                {
+                    unlink(temp.c_str());
+                    return;
+                }
+                // Without the lock file the result still goes in, it just never counts towards eviction
+                int lock = lockDirectory();
+                struct stat info;
+                std::uint64_t replaced = stat(path.c_str(), &info) == 0 ? info.st_size : 0;
+                if (rename(temp.c_str(), path.c_str()) != 0)
+                {
+                    unlink(temp.c_str());
+                }
+                else if (lock >= 0)
+                {
+                    std::uint64_t total;
+                    if (readTotal(lock, total) && stat(path.c_str(), &info) == 0)
+                    {
+                        total = total + info.st_size > replaced ? total + info.st_size - replaced : 0;
+                    }
+                    else
+                    {
+                        total = maxBytes + 1;
+                    }
+                    if (total > maxBytes)
+                    {
+                        scan(lock);
+                    }
+                    else
+                    {
+                        writeTotal(lock, total);
+                    }
+                }
+                unlockDirectory(lock);
+            }
+            void store(const std::string &kind, const std::vector<double> &params, const std::vector<double> &payload)
+            {
+                store(kind, params, payload.data(), payload.size());
+            }
+            // compute() returns std::vector<double>, it only runs on a miss
+            // Two processes missing the same key at once both compute, the last rename wins and both results are equal
+            template <class F>
+            CachedResult getOrCompute(const std::string &kind, const std::vector<double> &params, F compute)
+            {
+                std::optional<CachedResult> found = find(kind, params);
+                if (found)
+                {
+                    return std::move(*found);
+                }
+                std::vector<double> payload = compute();
+                store(kind, params, payload);
+                found = find(kind, params);
+                if (found)
+                {
+                    return std::move(*found);
+                }
+                // Evicted straight away or the directory isn't writable, hand back an anonymous mapping instead
+                std::size_t size = std::max<std::size_t>(1, payload.size() * sizeof(double));
+                void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (mapping == MAP_FAILED)
+                {
+                    return CachedResult(nullptr, 0, nullptr, 0);
+                }
+                std::memcpy(mapping, payload.data(), payload.size() * sizeof(double));
+                return CachedResult(mapping, size, static_cast<const double *>(mapping), payload.size());
+            }
+            // Least recently used first, by mtime
+            void evict()
+            {
+                int lock = lockDirectory();
+                if (lock >= 0)
+                {
+                    scan(lock);
+                }
+                unlockDirectory(lock);
+            }
+
+        private:
+            // A writer that has been at it this long has died
+            static constexpr std::time_t staleTemp = 3600;
+            // -1 if the lock file can't be opened, everything still works then, only without the running total
+            int lockDirectory() const
+            {
+                std::string lockPath = directory + "/.lock";
+                int lock = open(lockPath.c_str(), O_RDWR | O_CREAT, 0644);
+                if (lock >= 0)
+                {
+                    flock(lock, LOCK_EX);
+                }
+                return lock;
+            }
+            static void unlockDirectory(int lock)
+            {
+                if (lock >= 0)
+                {
+                    flock(lock, LOCK_UN);
+                    close(lock);
+                }
+            }
+            // A new lock file is empty, so the total is unknown until the first scan writes it
+            static bool readTotal(int lock, std::uint64_t &total)
+            {
+                return pread(lock, &total, sizeof(total), 0) == static_cast<ssize_t>(sizeof(total));
+            }
+            static bool writeTotal(int lock, std::uint64_t total)
+            {
+                return pwrite(lock, &total, sizeof(total), 0) == static_cast<ssize_t>(sizeof(total));
+            }
+            // Caller holds the lock
+            void scan(int lock)
+            {
+                struct Entry
+                {
+                    std::string path;
+                    std::uint64_t size;
+                    struct timespec used;
+                };
+                std::vector<Entry> entries;
+                std::uint64_t total = 0;
+                std::time_t now = std::time(nullptr);
+                if (DIR *dir = opendir(directory.c_str()))
+                {
+                    while (dirent *entry = readdir(dir))
+                    {
+                        std::string name = entry->d_name;
+                        std::string path = directory + "/" + name;
+                        struct stat info;
+                        if (name.find(".res.tmp.") != std::string::npos)
+                        {
+                            if (stat(path.c_str(), &info) == 0 && now - info.st_mtime > staleTemp)
+                            {
+                                unlink(path.c_str());
+                            }
+                            continue;
+                        }
+                        if (name.size() < 4 || name.compare(name.size() - 4, 4, ".res") != 0)
+                        {
+                            continue;
+                        }
+                        if (stat(path.c_str(), &info) == 0)
+                        {
+                            entries.push_back({path, static_cast<std::uint64_t>(info.st_size), info.st_mtim});
+                            total += info.st_size;
+                        }
+                    }
+                    closedir(dir);
+                }
+                if (total > maxBytes)
+                {
+                    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+                              { return a.used.tv_sec != b.used.tv_sec ? a.used.tv_sec < b.used.tv_sec : a.used.tv_nsec < b.used.tv_nsec; });
+                    for (const Entry &entry : entries)
+                    {
+                        if (total <= maxBytes)
+                        {
+                            break;
+                        }
+                        if (unlink(entry.path.c_str()) == 0)
+                        {
+                            total -= entry.size;
+                        }
+                    }
+                }
+                writeTotal(lock, total);
+            }
+            static std::size_t padded(std::size_t length)
+            {
+                return (length + 7) & ~static_cast<std::size_t>(7);
+            }
+            static bool writeAll(int fd, const void *data, std::size_t size)
+            {
+                const char *bytes = static_cast<const char *>(data);
+                while (size > 0)
+                {
+                    ssize_t written = write(fd, bytes, size);
+                    if (written <= 0)
+                    {
+                        return false;
+                    }
+                    bytes += written;
+                    size -= written;
+                }
+                return true;
+            }
+            std::string pathFor(std::uint64_t hash) const
+            {
+                char name[17];
+                for (int i = 15; i >= 0; i--)
+                {
+                    name[i] = "0123456789abcdef"[hash & 15];
+                    hash >>= 4;
+                }
+                name[16] = '\0';
+                return directory + "/" + name + ".res";
+            }
+            std::string directory;
+            std::uint64_t maxBytes;
+        };
+    }
+}
@@ -0,0 +1,373 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+namespace Hugh
+{
+    namespace Util
+    {
+        enum class TaskPriority
+        {
+            HIGH,
+            NORMAL,
+            LOW
+        };
+        // What a cancelled task's future throws
+        struct TaskCancelled : std::runtime_error
+        {
+            TaskCancelled() : std::runtime_error("task cancelled") {}
+        };
+        // Copies share one flag, cancel() stops anything not started yet
+        // Long running tasks can capture the token and check cancelled() themselves to stop early
+        struct CancellationToken
+        {
+            std::shared_ptr<std::atomic<bool>> flag = std::make_shared<std::atomic<bool>>(false);
+            void cancel()
+            {
+                flag->store(true);
+            }
+            bool cancelled() const
+            {
+                return flag->load();
+            }
+        };
+        // Work stealing pool, every worker has its own queue per priority for the tasks it submits itself
+        // A worker takes its newest task first, then the oldest task submitted from outside the pool, then steals
+        // the oldest task off someone else, always looking at HIGH before NORMAL before LOW
+        // Outside submissions share one queue so the oldest request is the next one started
+        // Results come back as std::future, inside a task use wait() rather than get() so the worker keeps running tasks
+        class ThreadPool
+        {
+        private:
+            template <class R>
+            struct MapResult
+            {
+                using type = std::vector<R>;
+            };
+            template <class R>
+            struct MapState
+            {
+                std::promise<std::vector<R>> promise;
+                std::vector<R> results;
+                std::atomic<std::size_t> remaining{0};
+                std::atomic<bool> failed{false};
+                void prepare(std::size_t count)
+                {
+                    results.resize(count);
+                }
+                template <class F>
+                void store(std::size_t i, F &f)
+                {
+                    results[i] = f(i);
+                }
+                void finish()
+                {
+                    promise.set_value(std::move(results));
+                }
+                void fail(std::exception_ptr error)
+                {
+                    if (!failed.exchange(true))
+                    {
+                        promise.set_exception(error);
+                    }
+                }
+            };
+
+        public:
+            explicit ThreadPool(unsigned threads = 0)
+            {
+                if (threads == 0)
+                {
+                    threads = std::max(1u, std::thread::hardware_concurrency());
+                }
+                for (unsigned i = 0; i < threads; i++)
+                {
+                    workers.push_back(std::make_unique<Worker>());
+                }
+                for (unsigned i = 0; i < threads; i++)
+                {
+                    pool.emplace_back([this, i]()
+                                      { run(i); });
+                }
+            }
+            // Whatever is queued still runs before the workers exit
+            ~ThreadPool()
+            {
+                {
+                    std::lock_guard<std::mutex> guard(sleepLock);
+                    stopping = true;
+                }
+                wake.notify_all();
+                for (std::thread &t : pool)
+                {
+                    t.join();
+                }
+            }
+            ThreadPool(const ThreadPool &) = delete;
+            ThreadPool &operator=(const ThreadPool &) = delete;
+            unsigned size() const
+            {
+                return static_cast<unsigned>(workers.size());
+            }
+            template <class F, class... Args>
+            auto submit(TaskPriority priority, CancellationToken token, F &&f, Args &&...args)
+                -> std::future<std::invoke_result_t<F, Args...>>
+            {
+                using R = std::invoke_result_t<F, Args...>;
+                auto task = std::make_shared<std::packaged_task<R()>>(
+                    [token, f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...)]() mutable -> R
+                    {
+                        if (token.cancelled())
+                        {
+                            throw TaskCancelled();
+                        }
+                        return std::apply(f, std::move(args));
+                    });
+                std::future<R> returnval = task->get_future();
+                push(priority, [task]()
+                     { (*task)(); });
+                return returnval;
+            }
+            template <class F, class... Args>
+            auto submit(F &&f, Args &&...args) -> std::future<std::invoke_result_t<F, Args...>>
+            {
+                return submit(TaskPriority::NORMAL, CancellationToken(), std::forward<F>(f), std::forward<Args>(args)...);
+            }
+            // f(i) for every i in [0, count), grain indices per task so tiny evaluations don't pay for a task each
+            // grain = 0 picks about four tasks per worker. The future holds every result in order, or the first exception
+            // Results are written from several threads at once, so f shouldn't return bool (std::vector<bool> packs bits)
+            template <class F>
+            auto map(std::size_t count, F f, TaskPriority priority = TaskPriority::NORMAL,
+                     CancellationToken token = CancellationToken(), std::size_t grain = 0)
+                -> std::future<typename MapResult<std::invoke_result_t<F, std::size_t>>::type>
+            {
+                using R = std::invoke_result_t<F, std::size_t>;
+                auto state = std::make_shared<MapState<R>>();
+                std::future<typename MapResult<R>::type> returnval = state->promise.get_future();
+                if (count == 0)
+                {
+                    state->finish();
+                    return returnval;
+                }
+                if (grain == 0)
+                {
+                    grain = std::max<std::size_t>(1, count / (4 * workers.size()));
+                }
+                std::size_t chunks = (count + grain - 1) / grain;
+                state->prepare(count);
+                state->remaining = chunks;
+                for (std::size_t c = 0; c < chunks; c++)
+                {
+                    std::size_t begin = c * grain;
+                    std::size_t end = std::min(count, begin + grain);
+                    push(priority, [state, f, token, begin, end]() mutable
+                         {
+                             try
+                             {
+                                 if (token.cancelled())
+                                 {
+                                     throw TaskCancelled();
+                                 }
+                                 for (std::size_t i = begin; i < end && !state->failed; i++)
+                                 {
+                                     state->store(i, f);
+                                 }
+                             }
+                             catch (...)
+                             {
+                                 state->fail(std::current_exception());
+                             }
+                             if (--state->remaining == 0 && !state->failed)
+                             {
+                                 state->finish();
+                             } });
+                }
+                return returnval;
+            }
+            // get() on a future from this pool. On one of its workers, queued tasks run until the future is ready,
+            // so a task waiting on work it submitted doesn't hold a worker and a one thread pool still finishes
+            template <class T>
+            T wait(std::future<T> future)
+            {
+                if (currentPool == this)
+                {
+                    std::function<void()> task;
+                    while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    {
+                        if (take(currentWorker, task))
+                        {
+                            task();
+                            task = nullptr;
+                        }
+                        else
+                        {
+                            future.wait_for(std::chrono::microseconds(100));
+                        }
+                    }
+                }
+                return future.get();
+            }
+
+        private:
+            struct Worker
+            {
+                std::mutex lock;
+                std::deque<std::function<void()>> queues[3];
+            };
+            void push(TaskPriority priority, std::function<void()> task)
+            {
+                if (currentPool == this)
+                {
+                    std::lock_guard<std::mutex> guard(workers[currentWorker]->lock);
+                    workers[currentWorker]->queues[static_cast<int>(priority)].push_back(std::move(task));
+                }
+                else
+                {
+                    std::lock_guard<std::mutex> guard(injectLock);
+                    injected[static_cast<int>(priority)].push_back(std::move(task));
+                }
+                {
+                    std::lock_guard<std::mutex> guard(sleepLock);
+                    pending++;
+                }
+                wake.notify_one();
+            }
+            bool pop(unsigned self, std::function<void()> &task)
+            {
+                for (int priority = 0; priority < 3; priority++)
+                {
+                    {
+                        std::lock_guard<std::mutex> guard(workers[self]->lock);
+                        std::deque<std::function<void()>> &own = workers[self]->queues[priority];
+                        if (!own.empty())
+                        {
+                            task = std::move(own.back());
+                            own.pop_back();
+                            return true;
+                        }
+                    }
+                    {
+                        std::lock_guard<std::mutex> guard(injectLock);
+                        if (!injected[priority].empty())
+                        {
+                            task = std::move(injected[priority].front());
+                            injected[priority].pop_front();
+                            return true;
+                        }
+                    }
+                    for (std::size_t offset = 1; offset < workers.size(); offset++)
+                    {
+                        Worker &victim = *workers[(self + offset) % workers.size()];
+                        std::lock_guard<std::mutex> guard(victim.lock);
+                        std::deque<std::function<void()>> &theirs = victim.queues[priority];
+                        if (!theirs.empty())
+                        {
+                            task = std::move(theirs.front());
+                            theirs.pop_front();
+                            return true;
+                        }
+                    }
+                }
+                return false;
+            }
+            bool take(unsigned self, std::function<void()> &task)
+            {
+                if (!pop(self, task))
+                {
+                    return false;
+                }
+                std::lock_guard<std::mutex> guard(sleepLock);
+                pending--;
+                return true;
+            }
+            void run(unsigned self)
+            {
+                currentPool = this;
+                currentWorker = self;
+                std::function<void()> task;
+                while (true)
+                {
+                    {
+                        std::unique_lock<std::mutex> guard(sleepLock);
+                        wake.wait(guard, [this]()
+                                  { return pending > 0 || stopping; });
+                        if (pending == 0 && stopping)
+                        {
+                            return;
+                        }
+                    }
+                    if (take(self, task))
+                    {
+                        task();
+                        task = nullptr;
+                    }
+                    else
+                    {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+            std::vector<std::unique_ptr<Worker>> workers;
+            std::mutex injectLock;
+            std::deque<std::function<void()>> injected[3];
+            std::vector<std::thread> pool;
+            std::mutex sleepLock;
+            std::condition_variable wake;
+            std::size_t pending = 0;
+            bool stopping = false;
+            static thread_local ThreadPool *currentPool;
+            static thread_local unsigned currentWorker;
+        };
+        template <>
+        struct ThreadPool::MapResult<void>
+        {
+            using type = void;
+        };
+        template <>
+        struct ThreadPool::MapState<void>
+        {
+            std::promise<void> promise;
+            std::atomic<std::size_t> remaining{0};
+            std::atomic<bool> failed{false};
+            void prepare(std::size_t)
+            {
+            }
+            template <class F>
+            void store(std::size_t i, F &f)
+            {
+                f(i);
+            }
+            void finish()
+            {
+                promise.set_value();
+            }
+            void fail(std::exception_ptr error)
+            {
+                if (!failed.exchange(true))
+                {
+                    promise.set_exception(error);
+                }
+            }
+        };
+        inline thread_local ThreadPool *ThreadPool::currentPool = nullptr;
+        inline thread_local unsigned ThreadPool::currentWorker = 0;
+        // One pool for the whole process, started the first time something asks for it
+        ThreadPool &sharedPool()
+        {
+            static ThreadPool pool;
+            return pool;
+        }
+    }
+}